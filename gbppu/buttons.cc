@@ -9,33 +9,79 @@
 #include "buttons.h"
 #include "io.h"
 
+// how often to look for input that should be applied as soon as possible
+#define BUTTONS_POLL_CYCLES 4096
+
+#define BUTTONS_LATEST 0x100
+
 buttons::buttons(io &io)
 	: _io     (io)
 	, _buttons(0)
+	, latest  (0)
 {
 }
 
+// P10-P13, low if pressed and selected
 uint8_t buttons::
-read()
+lines()
 {
-	uint8_t d8 = _io.reg[rP1] | 0xcf;
+	uint8_t d8 = 0x0f;
 	if (_io.reg[rP1] & 0x20) {
-		d8 &= (_buttons ^ 0xff) | 0xf0;
+		d8 &= ~_buttons;
 	}
 	if (_io.reg[rP1] & 0x10) {
-		d8 &= ((_buttons ^ 0xff) >> 4) | 0xf0;
+		d8 &= ~_buttons >> 4;
 	}
 	return d8;
 }
 
-void buttons::
-write(uint8_t a8, uint8_t d8)
+uint8_t buttons::
+read()
 {
-	_io.reg[a8] = d8;
+	return (_io.reg[rP1] | 0xcf) & (0xf0 | lines());
 }
 
 void buttons::
 set(uint8_t k)
 {
-    _buttons = k;
+	uint8_t old_lines = lines();
+	_buttons = k;
+	if (old_lines & ~lines()) {
+		// a line went low
+		_io.irq_set_pending(4);
+	}
+}
+
+bool buttons::
+push(uint64_t cycle, uint8_t k)
+{
+	return queue.push(cycle, k);
+}
+
+void buttons::
+set_latest(uint8_t k)
+{
+	latest.store(k | BUTTONS_LATEST, std::memory_order_release);
+}
+
+// Applies all queued input that is due. Input has to be queued in order;
+// input that arrives late is applied as soon as possible.
+void buttons::
+sync()
+{
+	const input_event_t *event;
+	while ((event = queue.peek()) && event->cycle <= _io.cycle) {
+		set(event->keys);
+		queue.pop();
+	}
+	uint16_t k = latest.exchange(0, std::memory_order_acquire);
+	if (k) {
+		set((uint8_t)k);
+	}
+
+	uint64_t next = _io.cycle + BUTTONS_POLL_CYCLES;
+	if (event && event->cycle < next) {
+		next = event->cycle;
+	}
+	_io.schedule(event_buttons, next);
 }
@@ -11,6 +11,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <atomic>
+#include "inputqueue.h"
 
 class io;
 
@@ -19,16 +21,27 @@ private:
 	io      &_io;
 	uint8_t  _buttons;
 
+	inputqueue queue;
+	// input to apply as soon as possible: the keys | BUTTONS_LATEST, or
+	// 0 if there is none; newer input replaces older, so none is lost
+	std::atomic<uint16_t> latest;
+
+	uint8_t lines();
+	void set(uint8_t buttons);
+
 protected:
 	friend class gb;
 	buttons(io &io);
 
 public:
 	uint8_t read();
-	void write(uint8_t a8, uint8_t d8);
+	void sync();
 
 public:
-	void set(uint8_t buttons);
+	// can be called from any one thread; false if the queue is full
+	bool push(uint64_t cycle, uint8_t buttons);
+	// can be called from any thread; never fails
+	void set_latest(uint8_t buttons);
 };
 
 
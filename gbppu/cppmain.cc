@@ -1,13 +1,224 @@
+//
+//  cppmain.cc
+//  gbppu
+//
+//  Runs a cartridge without a frontend, e.g. for test ROMs that report
+//  their results over the serial port.
+//
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "gb.h"
 
-int main()
+static const uint8_t mooneye_passed[] = { 3, 5, 8, 13, 21, 34 };
+static const uint8_t mooneye_failed[] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+static void
+usage(const char *argv0)
 {
-    gb gameboy;
+	fprintf(stderr, "usage: %s [-n frames] [-p pass] [-f fail] [-b] [-m] [-q] [-t trace] [-s] [-H] [-F] bootrom cartridge\n", argv0);
+	fprintf(stderr, "  -n frames  give up after this many frames (default: 3600)\n");
+	fprintf(stderr, "  -p string  pass when the serial output ends with string\n");
+	fprintf(stderr, "  -f string  fail when the serial output ends with string\n");
+	fprintf(stderr, "  -b         Blargg test ROMs: \"Passed\" and \"Failed\"\n");
+	fprintf(stderr, "  -m         Mooneye test ROMs: Fibonacci numbers and 0x42\n");
+	fprintf(stderr, "  -q         don't print the serial output\n");
+	fprintf(stderr, "  -t file    write the PPU trace to file (if built with PPU_TRACE)\n");
+	fprintf(stderr, "  -s         print memory statistics at exit (if built with MEMORY_STATS)\n");
+	fprintf(stderr, "  -H         print the video and audio hash of every frame\n");
+	fprintf(stderr, "  -F         compare every frame with one drawn by the pixel FIFO only;\n");
+	fprintf(stderr, "             fail at the first difference, pass if there is none\n");
+	fprintf(stderr, "exit status: 0 passed, 1 failed, 2 gave up, 3 CPU error\n");
+	exit(2);
+}
 
-    int ret = gameboy.step();
-    if (ret) {
-        exit(ret);
-    }
+// runs until the next frame has been drawn; false if that didn't happen
+// before the limit
+static bool
+next_frame(gb *gameboy, uint64_t limit)
+{
+	while (gameboy->get_cycles() < limit) {
+		if (gameboy->step() == step_cpu_error) {
+			return false;
+		}
+		// one instruction can't finish two frames
+		bool fresh;
+		gameboy->get_ppu_picture(&fresh);
+		if (fresh) {
+			return true;
+		}
+	}
+	return false;
 }
 
+int
+main(int argc, char **argv)
+{
+	long frames = 3600;
+	bool quiet = false;
+	const char *pass[SERIAL_MAX_TRIGGERS];
+	const char *fail[SERIAL_MAX_TRIGGERS];
+	int num_pass = 0;
+	int num_fail = 0;
+	bool blargg = false;
+	bool mooneye = false;
+	const char *trace_filename = 0;
+	bool memory_stats = false;
+	bool hashes = false;
+	bool compare = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "n:p:f:bmqt:sHF")) != -1) {
+		switch (c) {
+			case 'n':
+				frames = atol(optarg);
+				break;
+			case 'p':
+				if (num_pass < SERIAL_MAX_TRIGGERS) {
+					pass[num_pass++] = optarg;
+				}
+				break;
+			case 'f':
+				if (num_fail < SERIAL_MAX_TRIGGERS) {
+					fail[num_fail++] = optarg;
+				}
+				break;
+			case 'b':
+				blargg = true;
+				break;
+			case 'm':
+				mooneye = true;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 't':
+				trace_filename = optarg;
+				break;
+			case 's':
+				memory_stats = true;
+				break;
+			case 'H':
+				hashes = true;
+				break;
+			case 'F':
+				compare = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+
+	gb *gameboy = new gb(argv[optind], argv[optind + 1]);
+	gb *reference = 0;
+	if (compare) {
+		reference = new gb(argv[optind], argv[optind + 1]);
+		reference->set_ppu_fast_lines(false);
+		reference->set_hashing(true);
+	}
+	if (hashes || compare) {
+		gameboy->set_hashing(true);
+	} else {
+		// nothing looks at the screen
+		gameboy->set_ppu_frame_skip(-1);
+	}
+
+	// the pass triggers come first, so the trigger number tells them apart
+	for (int i = 0; i < num_pass; i++) {
+		gameboy->add_serial_trigger(pass[i]);
+	}
+	if (blargg) {
+		gameboy->add_serial_trigger("Passed");
+	}
+	if (mooneye) {
+		gameboy->add_serial_trigger(mooneye_passed, sizeof(mooneye_passed));
+	}
+	int first_fail = num_pass + blargg + mooneye;
+	for (int i = 0; i < num_fail; i++) {
+		gameboy->add_serial_trigger(fail[i]);
+	}
+	if (blargg) {
+		gameboy->add_serial_trigger("Failed");
+	}
+	if (mooneye) {
+		gameboy->add_serial_trigger(mooneye_failed, sizeof(mooneye_failed));
+	}
+
+	// count in cycles, the screen may be off
+	uint64_t limit = frames * 70224;
+	// a comparison without triggers passes unless there is a difference
+	int status = compare && !first_fail && !num_fail ? 0 : 2;
+	long frame = 0;
+	while (gameboy->get_cycles() < limit) {
+		int ret = gameboy->step();
+		bool fresh = false;
+		if (hashes || compare) {
+			// one instruction can't finish two frames
+			gameboy->get_ppu_picture(&fresh);
+		}
+		if (fresh && hashes) {
+			printf("frame %ld video %016llx audio %016llx\n", frame,
+				   (unsigned long long)gameboy->get_ppu_hash(),
+				   (unsigned long long)gameboy->take_sound_hash());
+		}
+		if (fresh && compare) {
+			// the PPU's timing doesn't depend on how lines are drawn, so
+			// the reference draws the same frame next
+			if (!next_frame(reference, limit)) {
+				fprintf(stderr, "frame %ld: the reference didn't finish it\n", frame);
+				status = 1;
+				break;
+			}
+			if (reference->get_ppu_hash() != gameboy->get_ppu_hash()) {
+				fprintf(stderr, "frame %ld: fast lines %016llx, pixel FIFO %016llx\n", frame,
+						(unsigned long long)gameboy->get_ppu_hash(),
+						(unsigned long long)reference->get_ppu_hash());
+				status = 1;
+				break;
+			}
+		}
+		if (fresh) {
+			frame++;
+		}
+		if (ret == step_cpu_error) {
+			status = 3;
+			break;
+		} else if (ret == step_serial_trigger) {
+			status = gameboy->get_serial_trigger() < first_fail ? 0 : 1;
+			break;
+		}
+	}
+
+	if (!quiet) {
+		size_t length;
+		const uint8_t *output = gameboy->get_serial_output(length);
+		fwrite(output, 1, length, stdout);
+		if (length && output[length - 1] != '\n') {
+			putchar('\n');
+		}
+	}
+
+	if (trace_filename) {
+		FILE *file = fopen(trace_filename, "wb");
+		if (file) {
+			gameboy->dump_ppu_trace(file);
+			fclose(file);
+		} else {
+			perror(trace_filename);
+		}
+	}
+
+	if (memory_stats) {
+		gameboy->dump_memory_stats(stderr);
+	}
+
+	gameboy->flush_log(stderr);
+	delete reference;
+	delete gameboy;
+	return status;
+}
@@ -524,7 +524,7 @@ cpu::cpu(memory &memory, io &io)
 #pragma mark - Steps
 
 #define NOT_YET_IMPLEMENTED()	do { \
-	printf("todo: pc=0x%04x, opcode=0x%02x\n", pc, opcode); \
+	LOG(_io, log_cpu, log_error, "todo: pc=0x%04x, opcode=0x%02x", pc, opcode); \
 	return 1; \
 } while(0);
 
@@ -551,9 +551,12 @@ step()
 		}
 		halted = 0;
 //		printf("RST 0x%02x\n", 0x40 + i * 8);
+		// the pushes are the vector's doing, not the interrupted instruction's
+		_memory.cpu_pc = 0x40 + i * 8;
 		rst8(0x40 + i * 8);
 	}
 
+	_memory.cpu_pc = pc;
 	uint8_t opcode = fetch8();
 //	static long long counter = 1;
 //	if (counter > 0) {//1000 * 1000 * 10.5) {
@@ -2010,7 +2013,7 @@ step()
 					break;
 
 				default:
-					printf("Unknown Prefix CB Opcode 0x%02x\n", opcode);
+					LOG(_io, log_cpu, log_error, "unknown prefix CB opcode 0x%02x", opcode);
 					return 1;
 					break;
 			}
@@ -2040,7 +2043,7 @@ step()
 			jpcc(!cf);
 			break;
 		case 0xd3: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xd4: // CALL NC,a16; 3; 24/12; ----
 			callcc(!cf);
@@ -2066,13 +2069,13 @@ step()
 			jpcc(cf);
 			break;
 		case 0xdb: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xdc: // CALL C,a16; 3; 24/12; ----
 			callcc(cf);
 			break;
 		case 0xdd: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xde: // SBC A,d8; 2; 8; Z 1 H C
 			sbca8(fetch8());
@@ -2091,10 +2094,10 @@ step()
 			_memory.write(0xff00 + c, a);
 			break;
 		case 0xe3: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xe4: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xe5: // PUSH HL; 1; 16; ----
 			push16(hl);
@@ -2115,13 +2118,13 @@ step()
 			_memory.write(fetch16(), a);
 			break;
 		case 0xeb: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xec: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xed: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xee: // XOR d8; 2; 8; Z 0 0 0
 			xora(fetch8());
@@ -2143,7 +2146,7 @@ step()
 			interrupts_enabled = 0;
 			break;
 		case 0xf4: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xf5: // PUSH AF; 1; 16; ----
 			push16(af);
@@ -2168,10 +2171,10 @@ step()
 			interrupts_enabled = 1;
 			break;
 		case 0xfc: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xfd: // crash
-			printf("crash: 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "crash: 0x%02x", opcode);
 			return 1;
 		case 0xfe: // CP d8; 2; 8; Z 1 H C
 			cpa8(fetch8());
@@ -2181,7 +2184,7 @@ step()
 			break;
 
 		default:
-			printf("Unknown Opcode 0x%02x\n", opcode);
+			LOG(_io, log_cpu, log_error, "unknown opcode 0x%02x", opcode);
 			return 1;
 	}
 
@@ -0,0 +1,147 @@
+//
+//  framebuffer.cc
+//  gbppu
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "framebuffer.h"
+#include "pixels.h"
+
+#define FRAMEBUFFER_FRESH 4
+#define FRAMEBUFFER_OWN_SIZE (FRAMEBUFFER_SIZE * FRAMEBUFFER_MAX_BPP)
+
+framebuffer::framebuffer()
+	: back(0)
+	, front(1)
+	, ready(2)
+	, hashing(false)
+{
+	own = (uint8_t *)calloc(3, FRAMEBUFFER_OWN_SIZE);
+	memset(changes, 0, sizeof(changes));
+	memset(line_hashes, 0, sizeof(line_hashes));
+	memset(hashes, 0, sizeof(hashes));
+	set_frames(0);
+	set_format(pixel_shade);
+}
+
+framebuffer::~framebuffer()
+{
+	free(own);
+}
+
+void framebuffer::
+set_frames(uint8_t *new_frames[3])
+{
+	for (int i = 0; i < 3; i++) {
+		frames[i] = new_frames ? new_frames[i] : own + i * FRAMEBUFFER_OWN_SIZE;
+	}
+}
+
+bool framebuffer::
+set_format(pixel_format_t new_format, size_t new_pitch, const uint32_t colors[3][4])
+{
+	static const uint32_t grays[4] = { 0xffffff, 0xaaaaaa, 0x555555, 0x000000 };
+	int new_bpp = new_format == pixel_rgb565 ? 2 :
+				  new_format == pixel_rgba8888 || new_format == pixel_bgra8888 ? 4 :
+				  1;
+	if (!new_pitch) {
+		new_pitch = FRAMEBUFFER_WIDTH * new_bpp;
+	}
+	if (new_pitch < (size_t)(FRAMEBUFFER_WIDTH * new_bpp) ||
+		(frames[0] == own && new_pitch * FRAMEBUFFER_HEIGHT > FRAMEBUFFER_OWN_SIZE)) {
+		return false;
+	}
+	format = new_format;
+	bpp = new_bpp;
+	pitch = new_pitch;
+	// no valid pixel is 0xff: all lines will change
+	memset(previous, 0xff, sizeof(previous));
+
+	for (int i = 0; i < 12; i++) {
+		int shade = i & 3;
+		uint32_t c = colors ? colors[i >> 2][shade] : format == pixel_indexed8 ? i : grays[shade];
+		uint8_t r = c >> 16, g = c >> 8, b = c;
+		uint16_t c565 = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+		uint8_t *p = lut[i];
+		switch (format) {
+			case pixel_shade:
+				p[0] = shade;
+				break;
+			case pixel_indexed8:
+				p[0] = c;
+				break;
+			case pixel_rgb565:
+				memcpy(p, &c565, 2);
+				break;
+			case pixel_rgba8888:
+				p[0] = r; p[1] = g; p[2] = b; p[3] = 0xff;
+				break;
+			case pixel_bgra8888:
+				p[0] = b; p[1] = g; p[2] = r; p[3] = 0xff;
+				break;
+		}
+	}
+	return true;
+}
+
+void framebuffer::
+put_line(int y, const uint8_t *pixels)
+{
+	pixels_convert(pixels, FRAMEBUFFER_WIDTH, lut, bpp, frames[back] + y * pitch);
+	if (hashing) {
+		// while the line is still in L1
+		line_hashes[y] = hash64::hash(pixels, FRAMEBUFFER_WIDTH);
+	}
+
+	uint8_t *prev = previous[y];
+	if (memcmp(prev, pixels, FRAMEBUFFER_WIDTH)) {
+		frame_changes_t *c = &changes[back];
+		c->lines[y >> 6] |= 1ULL << (y & 63);
+		for (int x = 0; x < FRAMEBUFFER_WIDTH / 8; x++) {
+			if (memcmp(prev + x * 8, pixels + x * 8, 8)) {
+				c->cells[y >> 3] |= 1 << x;
+			}
+		}
+		memcpy(prev, pixels, FRAMEBUFFER_WIDTH);
+	}
+}
+
+void framebuffer::
+publish()
+{
+	// a ready frame that the consumer hasn't taken yet will never be
+	// seen, so its changes have to be reported with this one; if the
+	// consumer takes it in the meantime, a little too much is reported
+	uint8_t r = ready.load(std::memory_order_acquire);
+	if (r & FRAMEBUFFER_FRESH) {
+		frame_changes_t *c = &changes[back];
+		const frame_changes_t *skipped = &changes[r & 3];
+		for (int i = 0; i < 3; i++) {
+			c->lines[i] |= skipped->lines[i];
+		}
+		for (int i = 0; i < 18; i++) {
+			c->cells[i] |= skipped->cells[i];
+		}
+	}
+
+	hashes[back] = hashing ? hash64::hash(line_hashes, sizeof(line_hashes)) : 0;
+
+	uint8_t old = ready.exchange(back | FRAMEBUFFER_FRESH, std::memory_order_acq_rel);
+	back = old & 3;
+	memset(&changes[back], 0, sizeof(frame_changes_t));
+}
+
+const uint8_t *framebuffer::
+acquire(bool *fresh)
+{
+	bool is_fresh = ready.load(std::memory_order_relaxed) & FRAMEBUFFER_FRESH;
+	if (is_fresh) {
+		uint8_t old = ready.exchange(front, std::memory_order_acq_rel);
+		front = old & 3;
+	}
+	if (fresh) {
+		*fresh = is_fresh;
+	}
+	return frames[front];
+}
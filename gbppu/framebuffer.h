@@ -0,0 +1,97 @@
+//
+//  framebuffer.h
+//  gbppu
+//
+
+#ifndef framebuffer_h
+#define framebuffer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "hash64.h"
+
+#define FRAMEBUFFER_WIDTH  160
+#define FRAMEBUFFER_HEIGHT 144
+#define FRAMEBUFFER_SIZE   (FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT) /* pixels */
+#define FRAMEBUFFER_MAX_BPP 4
+
+typedef enum {
+	pixel_shade,    // 1 byte: 0 (white) - 3 (black); the default
+	pixel_indexed8, // 1 byte: the color's low 8 bits
+	pixel_rgb565,   // 2 bytes, native endian
+	pixel_rgba8888, // 4 bytes: R, G, B, 0xff
+	pixel_bgra8888, // 4 bytes: B, G, R, 0xff
+} pixel_format_t;
+
+// what changed compared to the previous frame
+typedef struct {
+	uint64_t lines[3];  // bit y % 64 of lines[y / 64]: line y
+	uint32_t cells[18]; // bit x of cells[y]: the 8x8 cell at (x, y)
+} frame_changes_t;
+
+// Three frames, so neither side ever waits for the other: the PPU draws
+// into the back frame and publishes it by swapping it with the ready
+// frame, and the consumer (one thread) swaps a new ready frame with the
+// front frame it reads from.
+class framebuffer {
+private:
+	uint8_t *own;
+	uint8_t *frames[3];
+	int back;                   // only used by the producer
+	int front;                  // only used by the consumer
+	std::atomic<uint8_t> ready; // index, | FRAMEBUFFER_FRESH if not acquired yet
+
+	pixel_format_t format;
+	int bpp;
+	size_t pitch;
+	// every pixel as it is stored, by source << 2 | shade
+	uint8_t lut[12][FRAMEBUFFER_MAX_BPP];
+
+	// the lines as last drawn, by source << 2 | shade, and what changed
+	// in each frame
+	uint8_t previous[FRAMEBUFFER_HEIGHT][FRAMEBUFFER_WIDTH];
+	frame_changes_t changes[3];
+
+	// of every frame's lines, by source << 2 | shade, if enabled; the
+	// lines aren't always drawn in order, so each has its own hash
+	bool hashing;
+	uint64_t line_hashes[FRAMEBUFFER_HEIGHT];
+	uint64_t hashes[3];
+
+public:
+	framebuffer();
+	~framebuffer();
+
+	// use three caller-owned frames of get_pitch() * FRAMEBUFFER_HEIGHT
+	// bytes instead, or pass 0 to go back to the own ones
+	void set_frames(uint8_t *frames[3]);
+
+	// colors for BGP, OBP0 and OBP1 shades, as 0xRRGGBB (indexed: the
+	// index); 0 for white to black. A pitch of 0 means no padding, and
+	// the own frames can't be padded. false if the pitch is too small.
+	bool set_format(pixel_format_t format, size_t pitch = 0, const uint32_t colors[3][4] = 0);
+	inline size_t get_pitch() const
+	{ return pitch; }
+	// hash the lines as they are drawn; takes effect with the next frame
+	inline void set_hashing(bool enabled)
+	{ hashing = enabled; }
+
+	// producer
+	void put_line(int y, const uint8_t *pixels); // by source << 2 | shade
+	void publish();
+
+	// consumer: the most recent frame, which stays unchanged until the
+	// next call; fresh tells whether it has been returned before
+	const uint8_t *acquire(bool *fresh = 0);
+	// what changed in the frame last returned by acquire() since the one
+	// returned before it; may contain more than that
+	inline const frame_changes_t *get_changes() const
+	{ return &changes[front]; }
+	// the hash of the frame last returned by acquire(), independent of
+	// the format and colors; 0 if hashing was off
+	inline uint64_t get_hash() const
+	{ return hashes[front]; }
+};
+
+#endif /* framebuffer_h */
@@ -14,10 +14,10 @@
 
 //#define DEBUG_PPU
 
-gb::gb(const char *bootrom_filename, const char *cartridge_filename)
+gb::gb(const char *bootrom_filename, const char *cartridge_filename, const char *patch_filename)
 	: _ppu    (_memory, _io)
 	, _cpu    (_memory, _io)
-	, _memory (_ppu, _io, bootrom_filename, cartridge_filename)
+	, _memory (_ppu, _io, bootrom_filename, cartridge_filename, patch_filename)
 	, _io     (_ppu, _memory, _timer, _serial, _buttons, _sound)
 	, _timer  (_io)
 	, _serial (_io)
@@ -61,25 +61,22 @@ step()
 {
 #ifdef DEBUG_PPU
 	_ppu.step();
-	return 0;
+	return step_ok;
 #else
-	return _cpu.step();
+	if (_cpu.step()) {
+		return step_cpu_error;
+	}
+	if (_serial.triggered >= 0) {
+		return step_serial_trigger;
+	}
+	return step_ok;
 #endif
 }
 
 uint8_t *gb::
-copy_ppu_picture(size_t &pictureSize)
-{
-	pictureSize = sizeof(_ppu.picture);
-	uint8_t *pictureCopy = (uint8_t *)malloc(pictureSize);
-	memcpy(pictureCopy, _ppu.picture, pictureSize);
-	return pictureCopy;
-}
-
-uint8_t *gb::
-copy_tilemap(size_t &tilemapSize) {
-    tilemapSize = 8*2*(256 + 128);
-    uint8_t *pictureCopy = (uint8_t *)malloc(tilemapSize);
-    memcpy(pictureCopy, _ppu.vram, tilemapSize);
-    return pictureCopy;
+copy_tiles(size_t &tilesSize) {
+    tilesSize = sizeof(_ppu.tiles);
+    uint8_t *tilesCopy = (uint8_t *)malloc(tilesSize);
+    memcpy(tilesCopy, _ppu.tiles, tilesSize);
+    return tilesCopy;
 }
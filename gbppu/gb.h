@@ -9,14 +9,25 @@
 #ifndef gb_h
 #define gb_h
 
+#include <string.h>
 #include "buttons.h"
 #include "cpu.h"
 #include "io.h"
+#include "linkcable.h"
 #include "memory.h"
 #include "ppu.h"
+#include "ramsearch.h"
 #include "serial.h"
 #include "sound.h"
 #include "timer.h"
+#include "writelog.h"
+
+// results of gb::step()
+enum {
+	step_ok,
+	step_cpu_error,      // the CPU can't continue
+	step_serial_trigger, // the serial output matched a trigger
+};
 
 class gb {
 private:
@@ -30,22 +41,124 @@ private:
 
 public:
     sound   _sound;
-	gb(const char *bootrom_filename, const char *cartridge_filename);
+	gb(const char *bootrom_filename, const char *cartridge_filename, const char *patch_filename = 0);
 
 public:
     int step();
 
 public:
+    // can be called from another thread; applied as soon as possible.
+    // Only the most recent state counts, so this can't fail.
     inline void set_buttons(uint8_t keys)
-    { _buttons.set(keys); }
+    { _buttons.set_latest(keys); }
+    // applied at an exact cycle, for deterministic replays; has to be
+    // called in order. false if too much input is pending.
+    inline bool queue_buttons(uint64_t cycle, uint8_t keys)
+    { return _buttons.push(cycle, keys); }
 
 public:
     inline bool is_ppu_dirty() const
     { return _ppu.dirty; }
     inline void clear_ppu_dirty()
     { _ppu.dirty = false; }
-    uint8_t *copy_ppu_picture(size_t &size);
-    uint8_t *copy_tilemap(size_t &tilemap);
+    // the most recent complete frame, 160x144 pixels in the format set
+    // by set_ppu_format(), unchanged until the next call; can be called
+    // from one other thread
+    inline const uint8_t *get_ppu_picture(bool *fresh = 0)
+    { return _ppu.frames.acquire(fresh); }
+    // the lines and 8x8 cells of that frame that differ from the one
+    // get_ppu_picture() returned before
+    inline const frame_changes_t *get_ppu_changes() const
+    { return _ppu.frames.get_changes(); }
+    // how the PPU stores pixels (see framebuffer.h); call before the
+    // first step() or from the thread that calls step()
+    inline bool set_ppu_format(pixel_format_t format, size_t pitch = 0, const uint32_t colors[3][4] = 0)
+    { return _ppu.frames.set_format(format, pitch, colors); }
+    inline size_t get_ppu_pitch() const
+    { return _ppu.frames.get_pitch(); }
+    // draw into three frames of get_ppu_pitch() * 144 bytes owned by
+    // the caller; call before the first step()
+    inline void set_ppu_framebuffers(uint8_t *frames[3])
+    { _ppu.frames.set_frames(frames); }
+    // draw only every (skip + 1)th frame, or none with -1; the PPU's
+    // timing stays exact, and get_ppu_picture() keeps the last drawn one
+    inline void set_ppu_frame_skip(int skip)
+    { _ppu.frame_skip = skip; }
+    // false: draw every line with the pixel FIFO, which is slower but
+    // has to give the same pictures
+    inline void set_ppu_fast_lines(bool enabled)
+    { _ppu.fast_lines = enabled; }
+    // hash every drawn frame and the sound output, for regression and
+    // determinism tests; off by default
+    inline void set_hashing(bool enabled)
+    { _ppu.frames.set_hashing(enabled); _sound.hashing = enabled; }
+    // the hash of the frame get_ppu_picture() returned last
+    inline uint64_t get_ppu_hash() const
+    { return _ppu.frames.get_hash(); }
+    // the hash of the samples since the last call
+    inline uint64_t take_sound_hash()
+    { return _sound.take_hash(); }
+    // how often frames could be drawn in one pass
+    inline const ppu_stats_t *ppu_stats() const
+    { return &_ppu.stats; }
+    // all 384 tiles, 8x8 bytes each, one pixel (0-3) per byte
+    uint8_t *copy_tiles(size_t &size);
+
+public:
+	// all bytes sent over the serial port (the most recent ones, if there were many)
+	inline const uint8_t *get_serial_output(size_t &length) const
+	{ return _serial.get_capture(length); }
+	inline void clear_serial_output()
+	{ _serial.clear_capture(); }
+	// step() stops when the serial output ends with the pattern;
+	// returns the trigger's number, or -1 if there are too many
+	inline int add_serial_trigger(const uint8_t *pattern, size_t length)
+	{ return _serial.add_trigger(pattern, length); }
+	inline int add_serial_trigger(const char *string)
+	{ return _serial.add_trigger((const uint8_t *)string, strlen(string)); }
+	// the trigger that stopped step(), or -1
+	inline int get_serial_trigger() const
+	{ return _serial.triggered; }
+
+public:
+	// plugs this instance into one end (0 or 1) of a cable; pass 0 to unplug
+	inline void connect_link(linkcable *link, int port)
+	{ _serial.connect(link, port); }
+
+public:
+	// log messages are stored in binary form until they are formatted here
+	inline void flush_log(FILE *file)
+	{ _io.log.flush(file); }
+	inline void start_log_thread(FILE *file)
+	{ _io.log.start_thread(file); }
+	inline void set_log_filter(uint32_t categories, log_level_t level)
+	{ _io.log.set_filter(categories, level); }
+
+public:
+	inline uint64_t get_cycles() const
+	{ return _io.cycle; }
+
+public:
+	inline void snapshot_ram(struct ram_snapshot &snapshot)
+	{ _memory.snapshot_ram(snapshot); }
+
+	// records every bus write; pass 0 to stop recording
+	inline void set_writelog(writelog *writelog)
+	{ _memory.set_writelog(writelog); }
+
+public:
+	// only available if built with MEMORY_STATS
+	inline const memory_stats_t *memory_stats()
+	{ return _memory.get_stats(); }
+	inline void reset_memory_stats()
+	{ _memory.reset_stats(); }
+	inline void dump_memory_stats(FILE *file)
+	{ _memory.dump_stats(file); }
+	// only available if built with PPU_TRACE; see ppu_trace_entry_t
+	inline size_t dump_ppu_trace(FILE *file)
+	{ return _ppu.dump_trace(file); }
+	inline void reset_ppu_trace()
+	{ _ppu.reset_trace(); }
 };
 
 #endif  /* !gb_h */
@@ -0,0 +1,163 @@
+//
+//  hash64.cc
+//  gbppu
+//
+
+#include <string.h>
+#include "hash64.h"
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t
+rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// the hash is defined on little endian words
+static inline uint64_t
+read64(const uint8_t *p)
+{
+	uint64_t x;
+	memcpy(&x, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t x;
+	memcpy(&x, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = __builtin_bswap32(x);
+#endif
+	return x;
+}
+
+static inline uint64_t
+accumulate(uint64_t acc, uint64_t input)
+{
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+static inline uint64_t
+merge_round(uint64_t acc, uint64_t v)
+{
+	acc ^= accumulate(0, v);
+	return acc * prime1 + prime4;
+}
+
+// the four lanes are independent, so the CPU can run them in parallel
+static inline void
+stripes(uint64_t v[4], const uint8_t *p, size_t count)
+{
+	uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+	for (; count; count--, p += 32) {
+		v0 = accumulate(v0, read64(p));
+		v1 = accumulate(v1, read64(p + 8));
+		v2 = accumulate(v2, read64(p + 16));
+		v3 = accumulate(v3, read64(p + 24));
+	}
+	v[0] = v0; v[1] = v1; v[2] = v2; v[3] = v3;
+}
+
+hash64::hash64(uint64_t seed)
+{
+	reset(seed);
+}
+
+void hash64::
+reset(uint64_t new_seed)
+{
+	seed = new_seed;
+	v[0] = seed + prime1 + prime2;
+	v[1] = seed + prime2;
+	v[2] = seed;
+	v[3] = seed - prime1;
+	total = 0;
+	buffered = 0;
+}
+
+void hash64::
+update(const void *data, size_t length)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	total += length;
+
+	if (buffered) {
+		size_t n = 32 - buffered;
+		if (length < n) {
+			memcpy(buffer + buffered, p, length);
+			buffered += length;
+			return;
+		}
+		memcpy(buffer + buffered, p, n);
+		stripes(v, buffer, 1);
+		p += n;
+		length -= n;
+		buffered = 0;
+	}
+
+	stripes(v, p, length / 32);
+	p += length & ~(size_t)31;
+	length &= 31;
+
+	memcpy(buffer, p, length);
+	buffered = length;
+}
+
+uint64_t hash64::
+digest() const
+{
+	uint64_t h;
+	if (total >= 32) {
+		h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+		for (int i = 0; i < 4; i++) {
+			h = merge_round(h, v[i]);
+		}
+	} else {
+		h = seed + prime5;
+	}
+	h += total;
+
+	const uint8_t *p = buffer;
+	uint32_t length = buffered;
+	for (; length >= 8; length -= 8, p += 8) {
+		h ^= accumulate(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+	if (length >= 4) {
+		h ^= read32(p) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+		length -= 4;
+	}
+	for (; length; length--, p++) {
+		h ^= *p * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t hash64::
+hash(const void *data, size_t length, uint64_t seed)
+{
+	hash64 h(seed);
+	h.update(data, length);
+	return h.digest();
+}
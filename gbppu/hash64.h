@@ -0,0 +1,34 @@
+//
+//  hash64.h
+//  gbppu
+//
+
+#ifndef hash64_h
+#define hash64_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming XXH64: the data can be passed in pieces of any size, and
+// the result is the same as for one piece. Pieces that are multiples of
+// 32 bytes don't go through the buffer.
+class hash64 {
+private:
+	uint64_t v[4];
+	uint64_t total;
+	uint64_t seed;
+	uint8_t buffer[32];
+	uint32_t buffered;
+
+public:
+	hash64(uint64_t seed = 0);
+
+	void reset(uint64_t seed = 0);
+	void update(const void *data, size_t length);
+	// of everything since reset(); doesn't change the state
+	uint64_t digest() const;
+
+	static uint64_t hash(const void *data, size_t length, uint64_t seed = 0);
+};
+
+#endif /* hash64_h */
@@ -0,0 +1,12 @@
+//
+//  inputqueue.cc
+//  gbppu
+//
+
+#include "inputqueue.h"
+
+inputqueue::inputqueue()
+	: head(0)
+	, tail(0)
+{
+}
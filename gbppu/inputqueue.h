@@ -0,0 +1,58 @@
+//
+//  inputqueue.h
+//  gbppu
+//
+
+#ifndef inputqueue_h
+#define inputqueue_h
+
+#include <stdint.h>
+#include <atomic>
+
+#define INPUTQUEUE_SIZE 256 /* power of two */
+
+typedef struct {
+	uint64_t cycle; // when to apply; 0 means as soon as possible
+	uint8_t keys;
+} input_event_t;
+
+// A lock-free queue of button changes from one producer thread (the
+// UI) to the emulation thread.
+class inputqueue {
+private:
+	input_event_t events[INPUTQUEUE_SIZE];
+	std::atomic<uint32_t> head; // next to be read, only written by the consumer
+	std::atomic<uint32_t> tail; // next to be written, only written by the producer
+
+public:
+	inputqueue();
+
+	// producer; false if the queue is full
+	inline bool push(uint64_t cycle, uint8_t keys)
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == INPUTQUEUE_SIZE) {
+			return false;
+		}
+		events[t & (INPUTQUEUE_SIZE - 1)] = { cycle, keys };
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer; 0 if the queue is empty
+	inline const input_event_t *peek()
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return 0;
+		}
+		return &events[h & (INPUTQUEUE_SIZE - 1)];
+	}
+
+	inline void pop()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+#endif /* inputqueue_h */
@@ -53,22 +53,124 @@ io::io(ppu &ppu, memory &memory, timer &timer, serial &serial, buttons &buttons,
 	, _sound  (sound)
 {
 	memset(reg, 0, sizeof(reg));
+	cycle = 0;
+	// run everything once at power-on, so components schedule themselves
+	for (int i = 0; i < event_count; i++) {
+		event_cycle[i] = 0;
+	}
+	next_event = 0;
+
+	for (int a8 = 0; a8 < 256; a8++) {
+		read_handler[a8] = unassigned_read;
+		write_handler[a8] = 0;
+	}
+
+	read_handler[rP1] = buttons_read;
+	read_handler[rSB] = serial_read;
+	read_handler[rSC] = serial_read;
+	write_handler[rSB] = serial_write;
+	write_handler[rSC] = serial_write;
+	for (int a8 = rDIV; a8 <= rTAC; a8++) {
+		read_handler[a8] = 0;
+		write_handler[a8] = timer_write;
+	}
+	read_handler[rDIV] = timer_read;
+	read_handler[rTIMA] = timer_read;
+	read_handler[rIF] = 0;
+	read_handler[rIE] = 0;
+	for (int a8 = rNR10; a8 <= 0x3f; a8++) {
+		read_handler[a8] = sound_read;
+		write_handler[a8] = sound_write;
+	}
+	for (int a8 = rLCDC; a8 <= rWX; a8++) {
+		read_handler[a8] = 0;
+		write_handler[a8] = ppu_write;
+	}
+	read_handler[rSTAT] = ppu_read;
+	read_handler[rLY] = ppu_read;
+	write_handler[0x50] = memory_write;
+}
+
+#pragma mark - Dispatch
+
+uint8_t io::
+unassigned_read(io &io, uint8_t a8)
+{
+	return 0xff;
+}
+
+uint8_t io::
+buttons_read(io &io, uint8_t a8)
+{
+	io._buttons.sync();
+	return io._buttons.read();
+}
+
+uint8_t io::
+serial_read(io &io, uint8_t a8)
+{
+	io._serial.sync();
+	return io._serial.read(a8);
+}
+
+uint8_t io::
+sound_read(io &io, uint8_t a8)
+{
+	return io._sound.read(a8);
+}
+
+// Components are behind the CPU; catch them up before they see an access.
+
+uint8_t io::
+ppu_read(io &io, uint8_t a8)
+{
+	io._ppu.sync();
+	return io._ppu.io_read(a8);
+}
+
+void io::
+serial_write(io &io, uint8_t a8, uint8_t d8)
+{
+	io._serial.sync();
+	io._serial.write(a8, d8);
 }
 
 uint8_t io::
-irq_read(uint8_t a8)
+timer_read(io &io, uint8_t a8)
+{
+	io._timer.sync();
+	return io._timer.read(a8);
+}
+
+void io::
+timer_write(io &io, uint8_t a8, uint8_t d8)
 {
-	// these behave like RAM
-	return reg[a8];
+	io._timer.sync();
+	io._timer.write(a8, d8);
 }
 
 void io::
-irq_write(uint8_t a8, uint8_t d8)
+sound_write(io &io, uint8_t a8, uint8_t d8)
 {
-	// these behave like RAM
-	reg[a8] = d8;
+	io._sound.sync();
+	io._sound.write(a8, d8);
 }
 
+void io::
+ppu_write(io &io, uint8_t a8, uint8_t d8)
+{
+	io._ppu.sync();
+	io._ppu.io_write(a8, d8);
+}
+
+void io::
+memory_write(io &io, uint8_t a8, uint8_t d8)
+{
+	io._memory.io_write(a8, d8);
+}
+
+#pragma mark - IRQ
+
 uint8_t io::
 irq_get_pending()
 {
@@ -87,63 +189,49 @@ irq_clear_pending(uint8_t irq)
 	reg[rIF] &= ~(1 << irq);
 }
 
-
-uint8_t io::
-io_read(uint8_t a8)
-{
-	if (a8 == 0x00) {
-		return _buttons.read();
-	} else if (a8 == 0x01 || a8 == 0x02) {
-		return _serial.read(a8);
-	} else if (a8 >= 0x04 && a8 <= 0x07) {
-		return _timer.read(a8);
-	} else if (a8 == 0x0F || a8 == 0xFF) {
-		return irq_read(a8);
-	} else if (a8 >= 0x10 && a8 <= 0x3f) {
-		return _sound.read(a8);
-	} else if (a8 >= 0x40 && a8 <= 0x4b) {
-		return _ppu.io_read(a8);
-	} else {
-		// unassigned
-		return 0xff;
-	}
-}
+#pragma mark - Events
 
 void io::
-io_write(uint8_t a8, uint8_t d8)
-{
-	if (a8 == 0x00) {
-		_buttons.write(a8, d8);
-	} else if (a8 == 0x01 || a8 == 0x02) {
-		_serial.write(a8, d8);
-	} else if (a8 >= 0x04 && a8 <= 0x07) {
-		_timer.write(a8, d8);
-	} else if (a8 == 0x0F || a8 == 0xFF) {
-		irq_write(a8, d8);
-	} else if (a8 >= 0x10 && a8 <= 0x3f) {
-		_sound.write(a8, d8);
-	} else if (a8 >= 0x40 && a8 <= 0x4b) {
-		_ppu.io_write(a8, d8);
-	} else if (a8 == 0x50) {
-		_memory.io_write(a8, d8);
-	} else {
-		// do nothing
+schedule(event_t event, uint64_t when)
+{
+	event_cycle[event] = when;
+	if (when < next_event) {
+		next_event = when;
 	}
 }
 
 void io::
-io_step()
+dispatch()
 {
-	_timer.step();
-	_sound.step();
-	_ppu.step();
-}
+	for (int i = 0; i < event_count; i++) {
+		if (event_cycle[i] > cycle) {
+			continue;
+		}
+		// the handler schedules the next event
+		event_cycle[i] = EVENT_NEVER;
+		switch (i) {
+			case event_timer:
+				_timer.sync();
+				break;
+			case event_sound:
+				_sound.sync();
+				break;
+			case event_ppu:
+				_ppu.sync();
+				break;
+			case event_serial:
+				_serial.sync();
+				break;
+			case event_buttons:
+				_buttons.sync();
+				break;
+		}
+	}
 
-void io::
-io_step_4()
-{
-	io_step();
-	io_step();
-	io_step();
-	io_step();
+	next_event = EVENT_NEVER;
+	for (int i = 0; i < event_count; i++) {
+		if (event_cycle[i] < next_event) {
+			next_event = event_cycle[i];
+		}
+	}
 }
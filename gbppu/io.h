@@ -10,6 +10,7 @@
 #define io_h
 
 #include <stdint.h>
+#include "logger.h"
 
 #define rP1 0x00
 #define rLCDC 0x40
@@ -63,6 +64,18 @@ class timer;
 class sound;
 class ppu;
 
+// components that want to run at a certain cycle
+typedef enum {
+	event_timer,
+	event_sound,
+	event_ppu,
+	event_serial,
+	event_buttons,
+	event_count,
+} event_t;
+
+#define EVENT_NEVER UINT64_MAX
+
 class io {
 private:
 	ppu     &_ppu;
@@ -74,18 +87,54 @@ private:
 
 public:
 	uint8_t reg[256];
+	uint64_t cycle; // T-cycles since power-on
+	logger log;
+
+private:
+	uint64_t event_cycle[event_count];
+	uint64_t next_event; // earliest of event_cycle[]
+
+	void dispatch();
 
 protected:
 	friend class gb;
 	io(ppu &ppu, memory &memory, timer &timer, serial &serial, buttons &buttons, sound &sound);
 
 private:
-	uint8_t irq_read(uint8_t a8);
-	void irq_write(uint8_t a8, uint8_t d8);
+	// per-register handlers; registers without one behave like RAM
+	typedef uint8_t (*read_handler_t)(io &io, uint8_t a8);
+	typedef void (*write_handler_t)(io &io, uint8_t a8, uint8_t d8);
+	read_handler_t read_handler[256];
+	write_handler_t write_handler[256];
+
+	static uint8_t unassigned_read(io &io, uint8_t a8);
+	static uint8_t buttons_read(io &io, uint8_t a8);
+	static uint8_t serial_read(io &io, uint8_t a8);
+	static uint8_t sound_read(io &io, uint8_t a8);
+	static uint8_t ppu_read(io &io, uint8_t a8);
+	static uint8_t timer_read(io &io, uint8_t a8);
+	static void serial_write(io &io, uint8_t a8, uint8_t d8);
+	static void timer_write(io &io, uint8_t a8, uint8_t d8);
+	static void sound_write(io &io, uint8_t a8, uint8_t d8);
+	static void ppu_write(io &io, uint8_t a8, uint8_t d8);
+	static void memory_write(io &io, uint8_t a8, uint8_t d8);
 
 public:
-	uint8_t io_read(uint8_t a8);
-	void io_write(uint8_t a8, uint8_t d8);
+	inline uint8_t io_read(uint8_t a8)
+	{
+		read_handler_t handler = read_handler[a8];
+		return handler ? handler(*this, a8) : reg[a8];
+	}
+
+	inline void io_write(uint8_t a8, uint8_t d8)
+	{
+		write_handler_t handler = write_handler[a8];
+		if (handler) {
+			handler(*this, a8, d8);
+		} else {
+			reg[a8] = d8;
+		}
+	}
 
 public:
 	void irq_set_pending(uint8_t irq);
@@ -93,8 +142,17 @@ public:
 	void irq_clear_pending(uint8_t irq);
 
 public:
-	void io_step();
-	void io_step_4();
+	// components are only run when an event of theirs is due, or when
+	// the CPU accesses one of their registers
+	void schedule(event_t event, uint64_t when);
+
+	inline void io_step_4()
+	{
+		cycle += 4;
+		if (cycle >= next_event) {
+			dispatch();
+		}
+	}
 };
 
 #endif /* io_h */
@@ -0,0 +1,137 @@
+//
+//  linkcable.cc
+//  gbppu
+//
+
+#include <thread>
+#include "linkcable.h"
+
+linkcable::linkcable()
+	: version(0)
+	, waiters(0)
+{
+	for (int p = 0; p < 2; p++) {
+		port[p].connected = false;
+		port[p].now = 0;
+		port[p].transfer_end = UINT64_MAX;
+		port[p].out = 0xff;
+		port[p].answered = UINT64_MAX;
+		port[p].reply = 0xff;
+	}
+}
+
+void linkcable::
+connect(int p)
+{
+	port[p].now = 0;
+	port[p].transfer_end = UINT64_MAX;
+	port[p].answered = UINT64_MAX;
+	port[p].connected = true;
+	notify();
+}
+
+void linkcable::
+disconnect(int p)
+{
+	port[p].connected = false;
+	notify();
+}
+
+void linkcable::
+publish(int p, uint64_t now)
+{
+	if (port[p].now != now) {
+		port[p].now = now;
+		notify();
+	}
+}
+
+uint64_t linkcable::
+horizon(int p)
+{
+	port_t &peer = port[p ^ 1];
+	if (!peer.connected) {
+		return UINT64_MAX;
+	}
+
+	uint64_t h = peer.now + LINKCABLE_LOOKAHEAD;
+	uint64_t end = peer.transfer_end;
+	if (end < h && end != port[p].answered) {
+		h = end;
+	}
+	return h;
+}
+
+void linkcable::
+start_transfer(int p, uint64_t end, uint8_t out)
+{
+	port[p].out = out;
+	port[p].transfer_end = end;
+	notify();
+}
+
+bool linkcable::
+finish_transfer(int p, uint8_t &in)
+{
+	port_t &peer = port[p ^ 1];
+	if (!peer.connected) {
+		// nobody is driving the line
+		in = 0xff;
+	} else if (peer.answered == port[p].transfer_end) {
+		in = peer.reply;
+	} else {
+		return false;
+	}
+	port[p].transfer_end = UINT64_MAX;
+	notify();
+	return true;
+}
+
+bool linkcable::
+incoming_transfer(int p, uint64_t now, uint64_t &end, uint8_t &in)
+{
+	port_t &peer = port[p ^ 1];
+	end = peer.transfer_end;
+	if (end > now || end == port[p].answered) {
+		return false;
+	}
+	in = peer.out;
+	return true;
+}
+
+void linkcable::
+answer_transfer(int p, uint64_t end, uint8_t reply)
+{
+	port[p].reply = reply;
+	port[p].answered = end;
+	notify();
+}
+
+// Either the waiter sees the new version, or the notifier sees the
+// waiter and can only signal once the waiter is waiting: the
+// increments and loads are sequentially consistent, and the waiter
+// holds the mutex from its increment until it waits.
+void linkcable::
+notify()
+{
+	version++;
+	if (waiters.load()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		changed.notify_all();
+	}
+}
+
+void linkcable::
+wait(int tries, uint64_t seen)
+{
+	if (tries < LINKCABLE_SPINS) {
+		std::this_thread::yield();
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	waiters++;
+	while (version.load() == seen) {
+		changed.wait(lock);
+	}
+	waiters--;
+}
@@ -0,0 +1,76 @@
+//
+//  linkcable.h
+//  gbppu
+//
+
+#ifndef linkcable_h
+#define linkcable_h
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+// A byte takes 4096 T-cycles to transfer, so an instance can safely run
+// this far ahead of its peer: any transfer the peer starts later can't
+// end earlier.
+#define LINKCABLE_LOOKAHEAD 4096
+
+// A waiting side yields this many times before it blocks, so a peer
+// that is paused or gone doesn't keep a core busy
+#define LINKCABLE_SPINS 64
+
+// Connects the serial ports of two gb instances running on different
+// threads. The instances only wait for each other when one of them
+// would otherwise get more than LINKCABLE_LOOKAHEAD cycles ahead, or
+// at the end of a transfer. Times are counted from when each side
+// connected.
+class linkcable {
+private:
+	typedef struct {
+		std::atomic<bool>     connected;
+		std::atomic<uint64_t> now;          // how far this side has run
+		std::atomic<uint64_t> transfer_end; // of its own transfer, UINT64_MAX if none
+		std::atomic<uint8_t>  out;          // byte being sent
+		std::atomic<uint64_t> answered;     // transfer_end of the peer's transfer answered last
+		std::atomic<uint8_t>  reply;        // byte sent back in that transfer
+	} port_t;
+
+	port_t port[2];
+
+	// counts every change of either side's state; a side that has to
+	// wait sleeps until it changes
+	std::atomic<uint64_t> version;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::atomic<int> waiters;
+	void notify();
+
+public:
+	linkcable();
+
+	// called by serial
+	void connect(int p);
+	void disconnect(int p);
+	void publish(int p, uint64_t now);
+	// how far side p may run before it has to wait for its peer
+	uint64_t horizon(int p);
+
+	void start_transfer(int p, uint64_t end, uint8_t out);
+	// the peer's reply; false if it hasn't answered yet
+	bool finish_transfer(int p, uint8_t &in);
+
+	// a transfer of the peer that ends at or before now and hasn't been
+	// answered yet; false if there is none
+	bool incoming_transfer(int p, uint64_t now, uint64_t &end, uint8_t &in);
+	void answer_transfer(int p, uint64_t end, uint8_t reply);
+
+	// read before looking at the peer's state
+	inline uint64_t get_version() const
+	{ return version.load(); }
+	// waits until the state has changed since get_version() returned
+	// seen; tries counts the waits so far, the first ones only yield
+	void wait(int tries, uint64_t seen);
+};
+
+#endif /* linkcable_h */
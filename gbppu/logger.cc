@@ -0,0 +1,164 @@
+//
+//  logger.cc
+//  gbppu
+//
+
+#include <string.h>
+#include <chrono>
+#include "logger.h"
+
+static const char *category_name[] = {
+	"cpu", "memory", "io", "ppu", "sound", "timer", "serial",
+};
+
+static const char *level_name[] = {
+	"error", "warning", "info", "debug",
+};
+
+logger::logger()
+	: head          (0)
+	, tail          (0)
+	, dropped       (0)
+	, categories    (0xffffffff)
+	, level         (log_debug)
+	, thread_running(false)
+{
+}
+
+logger::~logger()
+{
+	if (thread_running) {
+		thread_running = false;
+		thread.join();
+	}
+}
+
+void logger::
+set_filter(uint32_t categories, log_level_t level)
+{
+	this->categories = categories;
+	this->level = level;
+}
+
+log_record_t *logger::
+reserve(uint64_t cycle, int category, int level, const char *format)
+{
+	if (!(categories & (1 << category)) || level > this->level) {
+		return 0;
+	}
+
+	uint32_t t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) == LOGGER_SIZE) {
+		dropped++;
+		return 0;
+	}
+
+	log_record_t *record = &records[t & (LOGGER_SIZE - 1)];
+	record->cycle = cycle;
+	record->format = format;
+	record->category = category;
+	record->level = level;
+	return record;
+}
+
+void logger::
+commit()
+{
+	tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+#pragma mark - Formatting
+
+// printf() with the arguments taken from the record, one conversion
+// at a time, so every argument can be passed with the type it expects
+void logger::
+format_record(FILE *file, const log_record_t *record)
+{
+	fprintf(file, "%12llu %s %s: ", (unsigned long long)record->cycle, category_name[record->category], level_name[record->level]);
+
+	const char *p = record->format;
+	int argi = 0;
+	while (*p) {
+		if (*p != '%') {
+			fputc(*p++, file);
+			continue;
+		}
+		if (p[1] == '%') {
+			fputc('%', file);
+			p += 2;
+			continue;
+		}
+
+		char spec[16];
+		size_t n = strspn(p + 1, "-+ #0123456789.hlzjt") + 2;
+		if (n >= sizeof(spec) || !p[n - 1]) {
+			// malformed
+			fputs(p, file);
+			break;
+		}
+		memcpy(spec, p, n);
+		spec[n] = 0;
+		p += n;
+
+		uint64_t a = argi < LOGGER_MAX_ARGS ? record->args[argi++] : 0;
+		bool is_long = strstr(spec, "l") != 0;
+		switch (spec[n - 1]) {
+			case 's':
+				fprintf(file, spec, a ? (const char *)(uintptr_t)a : "(null)");
+				break;
+			case 'p':
+				fprintf(file, spec, (void *)(uintptr_t)a);
+				break;
+			case 'd':
+			case 'i':
+			case 'c':
+				if (is_long) {
+					fprintf(file, spec, (long long)a);
+				} else {
+					fprintf(file, spec, (int)a);
+				}
+				break;
+			default:
+				if (is_long) {
+					fprintf(file, spec, (unsigned long long)a);
+				} else {
+					fprintf(file, spec, (unsigned int)a);
+				}
+				break;
+		}
+	}
+	fputc('\n', file);
+}
+
+void logger::
+flush(FILE *file)
+{
+	uint32_t h = head.load(std::memory_order_relaxed);
+	uint32_t t = tail.load(std::memory_order_acquire);
+	for (; h != t; h++) {
+		format_record(file, &records[h & (LOGGER_SIZE - 1)]);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	uint64_t d = dropped.exchange(0);
+	if (d) {
+		fprintf(file, "(%llu log records dropped)\n", (unsigned long long)d);
+	}
+	fflush(file);
+}
+
+void logger::
+start_thread(FILE *file)
+{
+	if (thread_running) {
+		return;
+	}
+	thread_running = true;
+	thread = std::thread([this, file]() {
+		while (thread_running) {
+			flush(file);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		flush(file);
+	});
+}
@@ -0,0 +1,111 @@
+//
+//  logger.h
+//  gbppu
+//
+
+#ifndef logger_h
+#define logger_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+typedef enum {
+	log_cpu,
+	log_memory,
+	log_io,
+	log_ppu,
+	log_sound,
+	log_timer,
+	log_serial,
+} log_category_t;
+
+typedef enum {
+	log_error,
+	log_warning,
+	log_info,
+	log_debug,
+} log_level_t;
+
+// Messages of other categories, or above this level, are compiled out.
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES 0xffffffff
+#endif
+#ifndef LOG_LEVEL
+#define LOG_LEVEL log_warning
+#endif
+
+#define LOGGER_SIZE 4096 /* records, power of two */
+#define LOGGER_MAX_ARGS 4
+
+// LOG(io, category, level, format, ...)
+// The format has to be a string constant; arguments are integers or
+// string constants. Nothing is formatted on the emulation thread.
+#define LOG(io, category, level, ...) do { \
+	if ((LOG_CATEGORIES & (1 << (category))) && (level) <= LOG_LEVEL) { \
+		(io).log.add((io).cycle, category, level, __VA_ARGS__); \
+	} \
+} while (0)
+
+typedef struct {
+	uint64_t cycle;
+	const char *format;
+	uint64_t args[LOGGER_MAX_ARGS];
+	uint8_t category;
+	uint8_t level;
+} log_record_t;
+
+// A ring buffer of binary log records. One thread (the emulation) adds
+// records, one other thread formats them, or it is done at exit.
+// Records that don't fit are counted and dropped.
+class logger {
+private:
+	log_record_t records[LOGGER_SIZE];
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	std::atomic<uint64_t> dropped;
+
+	uint32_t categories;
+	log_level_t level;
+
+	std::thread thread;
+	std::atomic<bool> thread_running;
+
+	log_record_t *reserve(uint64_t cycle, int category, int level, const char *format);
+	void commit();
+
+	static inline uint64_t arg(const char *s)
+	{ return (uint64_t)(uintptr_t)s; }
+	template <typename T> static inline uint64_t arg(T i)
+	{ return (uint64_t)(int64_t)i; }
+
+	static void format_record(FILE *file, const log_record_t *record);
+
+public:
+	logger();
+	~logger();
+
+	// runtime filter, within what was compiled in
+	void set_filter(uint32_t categories, log_level_t level);
+
+	template <typename... T>
+	inline void add(uint64_t cycle, int category, int level, const char *format, T... args)
+	{
+		static_assert(sizeof...(T) <= LOGGER_MAX_ARGS, "too many log arguments");
+		log_record_t *record = reserve(cycle, category, level, format);
+		if (record) {
+			uint64_t a[LOGGER_MAX_ARGS] = { arg(args)... };
+			memcpy(record->args, a, sizeof(a));
+			commit();
+		}
+	}
+
+	// formats all pending records
+	void flush(FILE *file);
+	// formats records in the background until destruction
+	void start_thread(FILE *file);
+};
+
+#endif /* logger_h */
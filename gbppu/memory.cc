@@ -7,9 +7,67 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memory.h"
 #include "io.h"
 #include "ppu.h"
+#include "patch.h"
+#include "ramsearch.h"
+#include "writelog.h"
+
+// Maps a file privately: pages are shared with the page cache
+// until they are written to.
+static uint8_t *
+map_file(const char *filename, size_t &size)
+{
+	size = 0;
+	int fd = filename ? open(filename, O_RDONLY) : -1;
+	if (fd < 0) {
+		return 0;
+	}
+
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		size = st.st_size;
+		data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		size = 0;
+		return 0;
+	}
+	return (uint8_t *)data;
+}
+
+// Releases an image, which is a mapping if mapsize is nonzero.
+static void
+release(uint8_t *image, size_t mapsize)
+{
+	if (mapsize) {
+		munmap(image, mapsize);
+	} else {
+		free(image);
+	}
+}
+
+// Copies an image into a zero-filled heap buffer of a different size
+// and releases the original.
+static uint8_t *
+materialize(uint8_t *image, size_t image_size, size_t &mapsize, size_t size)
+{
+	uint8_t *data = (uint8_t *)calloc(size, 1);
+	if (image) {
+		memcpy(data, image, image_size < size ? image_size : size);
+		release(image, mapsize);
+	}
+	mapsize = 0;
+	return data;
+}
 
 void memory::
 read_bootrom(const char *filename)
@@ -25,13 +83,49 @@ read_bootrom(const char *filename)
 }
 
 void memory::
-read_rom(const char *filename)
+read_rom(const char *filename, const char *patch_filename)
 {
+	size_t filesize;
+	rom = map_file(filename, filesize);
+	romimagesize = filesize;
+	size_t mapsize = filesize;
+
+	if (rom && patch_filename) {
+		size_t patchsize;
+		uint8_t *patch = map_file(patch_filename, patchsize);
+		size_t targetsize = patch ? patch_target_size(patch, patchsize, filesize) : 0;
+		// the unpatched image stays available as the patch source
+		size_t sourcesize;
+		uint8_t *source = targetsize ? map_file(filename, sourcesize) : 0;
+		if (source) {
+			if (targetsize > filesize) {
+				rom = materialize(rom, filesize, mapsize, targetsize);
+			}
+			romimagesize = targetsize;
+			if (!patch_apply(patch, patchsize, source, sourcesize, rom, romimagesize)) {
+				// don't run a partially patched image
+				printf("warning: could not apply patch %s, running the unpatched image\n", patch_filename);
+				release(rom, mapsize);
+				rom = source;
+				mapsize = sourcesize;
+				romimagesize = sourcesize;
+			} else {
+				munmap(source, sourcesize);
+			}
+		} else {
+			printf("warning: could not read patch %s\n", patch_filename);
+		}
+		if (patch) {
+			munmap(patch, patchsize);
+		}
+	}
+
+	// the header is parsed from the (possibly patched) image
 	uint8_t header[0x100];
-	FILE *file = fopen(filename, "r");
-	if (file) {
-		fseek(file, 0x100, SEEK_SET);
-		fread(header, 0x100, 1, file);
+	memset(header, 0, sizeof(header));
+	if (romimagesize > 0x100) {
+		size_t headersize = romimagesize - 0x100;
+		memcpy(header, rom + 0x100, headersize < sizeof(header) ? headersize : sizeof(header));
 	}
 
 	mbc = mbc_none;
@@ -216,12 +310,19 @@ read_rom(const char *filename)
 		}
 	}
 
-    if (file) {
-		fseek(file, 0L, SEEK_SET);
-		rom = (uint8_t *)calloc(romsize, 1);
-		fread(rom, romsize, 1, file);
-		fclose(file);
-    }
+	if (romimagesize < romsize) {
+		// pad short images instead of mapping past the end of the file
+		rom = materialize(rom, romimagesize, mapsize, romsize);
+		romimagesize = romsize;
+	}
+	rommapsize = mapsize;
+
+	// bank numbers wrap around at the next power of two, like the
+	// unconnected address lines of the cartridge ROM
+	rom_bank_mask = 1;
+	while (rom_bank_mask + 1u < romsize / 0x4000) {
+		rom_bank_mask = (rom_bank_mask << 1) | 1;
+	}
 
 	rom_bank = 0;
     if (extramsize == 0 && extram) {
@@ -237,12 +338,12 @@ read_rom(const char *filename)
     }
 }
 
-memory::memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartridge_filename)
+memory::memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartridge_filename, const char *patch_filename)
 	: _ppu(ppu)
 	, _io (io)
 {
     extram = 0;
-    read_rom(cartridge_filename);
+    read_rom(cartridge_filename, patch_filename);
     read_bootrom(bootrom_filename);
 
     ram = (uint8_t *)calloc(0x2000, 1);
@@ -251,6 +352,9 @@ memory::memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartr
 	banking_mode_is_ram = false;
 	ram_bank = 0;
 	rom_bank = 0;
+	reset_stats();
+	_writelog = 0;
+	cpu_pc = 0;
 
 #if 0
 	file = fopen("/Users/mist/Documents/git/gbcpu/gbppu/ram.bin", "r");
@@ -264,42 +368,81 @@ memory::memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartr
 #endif
 }
 
+memory::~memory()
+{
+	release(rom, rommapsize);
+	free(bootrom);
+	free(ram);
+	free(hiram);
+	free(extram);
+}
+
+uint8_t memory::
+current_rom_bank()
+{
+	if (mbc == mbc1) {
+		uint8_t bank = rom_bank;
+		if (banking_mode_is_ram) {
+			bank &= 0x1f;
+		}
+		if ((bank & 0x1f) == 0) {
+			bank++;
+		}
+		return bank;
+	} else {
+		return 1;
+	}
+}
+
 uint8_t memory::
 read(uint16_t a16)
 {
 	_io.io_step_4();
 
+#ifdef MEMORY_STATS
+	stats.page_reads[a16 >> 8]++;
+#endif
+
 	if (a16 < 0x4000) {
 		if (bootrom_enabled && a16 < 0x100) {
 			return bootrom[a16];
 		} else {
+#ifdef MEMORY_STATS
+			stats.rom_bank_reads[0]++;
+#endif
 			return rom[a16];
 		}
 	} else if (a16 >= 0x4000 && a16 < 0x8000) {
 		if (mbc == mbc_none) {
+#ifdef MEMORY_STATS
+			stats.rom_bank_reads[1]++;
+#endif
 			return rom[a16];
 		} else if (mbc == mbc1) {
-			uint8_t bank = rom_bank;
-			if (banking_mode_is_ram) {
-				bank &= 0x1f;
-			}
-			if ((bank & 0x1f) == 0) {
-				bank++;
-			}
+			uint8_t bank = current_rom_bank() & rom_bank_mask;
+#ifdef MEMORY_STATS
+			stats.rom_bank_reads[bank]++;
+#endif
 			uint32_t address = a16 - 0x4000 + bank * 0x4000;
-			if (address > romsize) {
+			if (address >= romimagesize) {
 				return 0xff;
 			} else {
 				return rom[address];
 			}
 		} else {
 //			printf("warning: unsupported MBC read!\n");
+#ifdef MEMORY_STATS
+			stats.rom_bank_reads[1]++;
+#endif
 			return rom[a16];
 		}
 	} else if (a16 >= 0x8000 && a16 < 0xa000) {
 		return _ppu.vram_read(a16 - 0x8000);
 	} else if (a16 >= 0xa000 && a16 < 0xc000) {
 		uint32_t address = a16 - 0xa000 + ram_bank * 0x2000;
+#ifdef MEMORY_STATS
+		stats.ram_bank_reads[ram_bank & 15]++;
+#endif
 		if (address < extramsize) {
 			return extram[address];
 		} else {
@@ -326,6 +469,22 @@ read(uint16_t a16)
 void memory::
 write_internal(uint16_t a16, uint8_t d8)
 {
+#ifdef MEMORY_STATS
+	stats.page_writes[a16 >> 8]++;
+	uint8_t old_rom_bank = rom_bank;
+	uint8_t old_ram_bank = ram_bank;
+#endif
+
+	if (_writelog) {
+		uint8_t bank = 0;
+		if (cpu_pc >= 0x4000 && cpu_pc < 0x8000) {
+			bank = current_rom_bank();
+		} else if (cpu_pc >= 0xa000 && cpu_pc < 0xc000) {
+			bank = ram_bank;
+		}
+		_writelog->add(_io.cycle, bank, cpu_pc, a16, d8);
+	}
+
 	if (a16 < 0x8000) {
 		if (mbc == mbc1) {
 			switch (a16 >> 13) {
@@ -349,10 +508,18 @@ write_internal(uint16_t a16, uint8_t d8)
 		} else {
 //			printf("warning: unsupported MBC write!\n");
 		}
+#ifdef MEMORY_STATS
+		// whichever MBC changed them
+		stats.rom_bank_switches += rom_bank != old_rom_bank;
+		stats.ram_bank_switches += ram_bank != old_ram_bank;
+#endif
 	} else if (a16 >= 0x8000 && a16 < 0xa000) {
 		_ppu.vram_write(a16 - 0x8000, d8);
 	} else if (a16 >= 0xa000 && a16 < 0xc000) {
 		uint32_t address = a16 - 0xa000 + ram_bank * 0x2000;
+#ifdef MEMORY_STATS
+		stats.ram_bank_writes[ram_bank & 15]++;
+#endif
 		if (address < extramsize) {
 			extram[address] = d8;
 		} else {
@@ -393,3 +560,66 @@ is_bootrom_enabled()
 {
 	return bootrom_enabled;
 }
+
+void memory::
+snapshot_ram(ram_snapshot_t &snapshot)
+{
+	memcpy(snapshot.data + RAMSEARCH_WRAM_OFFSET, ram, 0x2000);
+	memcpy(snapshot.data + RAMSEARCH_HRAM_OFFSET, hiram, 0x7f);
+	snapshot.extramsize = extram ? extramsize : 0;
+	if (snapshot.extramsize) {
+		memcpy(snapshot.data + RAMSEARCH_EXTRAM_OFFSET, extram, extramsize);
+	}
+}
+
+void memory::
+set_writelog(writelog *writelog)
+{
+	_writelog = writelog;
+}
+
+#pragma mark - Statistics
+
+const memory_stats_t *memory::
+get_stats()
+{
+#ifdef MEMORY_STATS
+	return &stats;
+#else
+	return 0;
+#endif
+}
+
+void memory::
+reset_stats()
+{
+#ifdef MEMORY_STATS
+	memset(&stats, 0, sizeof(stats));
+#endif
+}
+
+void memory::
+dump_stats(FILE *file)
+{
+#ifdef MEMORY_STATS
+	fprintf(file, "page   reads      writes\n");
+	for (int i = 0; i < 256; i++) {
+		if (stats.page_reads[i] || stats.page_writes[i]) {
+			fprintf(file, "%02x00 %10llu %10llu\n", i, (unsigned long long)stats.page_reads[i], (unsigned long long)stats.page_writes[i]);
+		}
+	}
+	fprintf(file, "ROM bank reads\n");
+	for (int i = 0; i < 256; i++) {
+		if (stats.rom_bank_reads[i]) {
+			fprintf(file, "%3d %10llu\n", i, (unsigned long long)stats.rom_bank_reads[i]);
+		}
+	}
+	fprintf(file, "RAM bank reads     writes\n");
+	for (int i = 0; i < 16; i++) {
+		if (stats.ram_bank_reads[i] || stats.ram_bank_writes[i]) {
+			fprintf(file, "%3d %10llu %10llu\n", i, (unsigned long long)stats.ram_bank_reads[i], (unsigned long long)stats.ram_bank_writes[i]);
+		}
+	}
+	fprintf(file, "bank switches: ROM %llu, RAM %llu\n", (unsigned long long)stats.rom_bank_switches, (unsigned long long)stats.ram_bank_switches);
+#endif
+}
@@ -12,8 +12,23 @@
 #include <stdio.h>
 #include <stdint.h>
 
+// define to count bus accesses per 256 byte page and per bank
+//#define MEMORY_STATS
+
 class io;
 class ppu;
+class writelog;
+struct ram_snapshot;
+
+typedef struct {
+	uint64_t page_reads[256];
+	uint64_t page_writes[256];
+	uint64_t rom_bank_reads[256];
+	uint64_t ram_bank_reads[16];
+	uint64_t ram_bank_writes[16];
+	uint64_t rom_bank_switches; // only MBC1 switches banks so far
+	uint64_t ram_bank_switches;
+} memory_stats_t;
 
 class memory {
 private:
@@ -43,6 +58,9 @@ private:
 	int has_timer;
 	int has_rumble;
 	uint32_t romsize;
+	size_t romimagesize;
+	size_t rommapsize;     // of the ROM image if it is a mapping, else 0
+	uint8_t rom_bank_mask;
 	uint16_t extramsize;
 	bool ram_enabled;
 	uint8_t rom_bank;
@@ -50,17 +68,25 @@ private:
 	bool banking_mode_is_ram;
 	bool bootrom_enabled;
 
+#ifdef MEMORY_STATS
+	memory_stats_t stats;
+#endif
+
+	writelog *_writelog;
+
+	uint8_t current_rom_bank();
 	void write_internal(uint16_t a16, uint8_t d8);
 
 protected:
 	friend class gb;
-	memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartridge_filename);
+	memory(ppu &ppu, io &io, const char *bootrom_filename, const char *cartridge_filename, const char *patch_filename);
+	~memory();
 
 public:
 	void init();
 
     void read_bootrom(const char *filename);
-    void read_rom(const char *filename);
+    void read_rom(const char *filename, const char *patch_filename = 0);
     
     uint8_t read(uint16_t a16);
 	void write(uint16_t a16, uint8_t d8);
@@ -68,6 +94,18 @@ public:
 	void io_write(uint8_t a8, uint8_t d8);
 
 	bool is_bootrom_enabled();
+
+public:
+	uint16_t cpu_pc; // start of the current instruction
+
+public:
+	void snapshot_ram(struct ram_snapshot &snapshot);
+	void set_writelog(writelog *writelog);
+
+public:
+	const memory_stats_t *get_stats();
+	void reset_stats();
+	void dump_stats(FILE *file);
 };
 
 #endif /* memory_h */
@@ -0,0 +1,341 @@
+//
+//  patch.cc
+//  gbppu
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "patch.h"
+
+// see references:
+
+// - IPS
+// http://fileformats.archiveteam.org/wiki/IPS_(binary_patch_format)
+
+// - UPS/BPS
+// https://www.romhacking.net/documents/392/ (UPS)
+// https://www.romhacking.net/documents/746/ (BPS)
+
+#pragma mark - Helper
+
+static uint32_t
+crc32(const uint8_t *data, size_t size)
+{
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int j = 0; j < 8; j++) {
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	}
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+static uint32_t
+read32le(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// UPS and BPS variable length integers
+static bool
+read_number(const uint8_t *&p, const uint8_t *end, uint64_t &number)
+{
+	uint64_t shift = 1;
+	number = 0;
+	while (p < end) {
+		uint8_t x = *p++;
+		number += (x & 0x7f) * shift;
+		if (x & 0x80) {
+			return true;
+		}
+		shift <<= 7;
+		number += shift;
+	}
+	return false;
+}
+
+// only write bytes that differ, so unchanged pages of a
+// copy-on-write target stay shared with the source
+static inline void
+poke(uint8_t *target, size_t offset, uint8_t d8)
+{
+	if (target[offset] != d8) {
+		target[offset] = d8;
+	}
+}
+
+#pragma mark - IPS
+
+static size_t
+ips_target_size(const uint8_t *patch, size_t patch_size, size_t source_size)
+{
+	const uint8_t *p = patch + 5;
+	const uint8_t *end = patch + patch_size;
+	size_t size = source_size;
+
+	while (p + 3 <= end) {
+		if (!memcmp(p, "EOF", 3)) {
+			p += 3;
+			if (p + 3 <= end) {
+				// optional truncation extension
+				size = (p[0] << 16) | (p[1] << 8) | p[2];
+			}
+			return size;
+		}
+		if (p + 5 > end) {
+			break;
+		}
+		size_t offset = (p[0] << 16) | (p[1] << 8) | p[2];
+		size_t length = (p[3] << 8) | p[4];
+		p += 5;
+		if (!length) {
+			if (p + 3 > end) {
+				break;
+			}
+			length = (p[0] << 8) | p[1];
+			p += 3;
+		} else {
+			if (p + length > end) {
+				break;
+			}
+			p += length;
+		}
+		if (offset + length > size) {
+			size = offset + length;
+		}
+	}
+	return 0;
+}
+
+static bool
+ips_apply(const uint8_t *patch, size_t patch_size, uint8_t *target, size_t target_size)
+{
+	const uint8_t *p = patch + 5;
+	const uint8_t *end = patch + patch_size;
+
+	while (p + 3 <= end && memcmp(p, "EOF", 3)) {
+		// records that end past the patch are errors, not data
+		if (p + 5 > end) {
+			return false;
+		}
+		size_t offset = (p[0] << 16) | (p[1] << 8) | p[2];
+		size_t length = (p[3] << 8) | p[4];
+		p += 5;
+		if (!length) {
+			// RLE record
+			if (p + 3 > end) {
+				return false;
+			}
+			length = (p[0] << 8) | p[1];
+			for (size_t i = 0; i < length && offset + i < target_size; i++) {
+				poke(target, offset + i, p[2]);
+			}
+			p += 3;
+		} else {
+			if (p + length > end) {
+				return false;
+			}
+			for (size_t i = 0; i < length && offset + i < target_size; i++) {
+				poke(target, offset + i, p[i]);
+			}
+			p += length;
+		}
+	}
+	// no "EOF": the patch is truncated
+	return p + 3 <= end;
+}
+
+#pragma mark - UPS
+
+static bool
+ups_apply(const uint8_t *patch, size_t patch_size, const uint8_t *source, size_t source_size, uint8_t *target, size_t target_size)
+{
+	const uint8_t *p = patch + 4;
+	const uint8_t *end = patch + patch_size - 12;
+	uint64_t input_size, output_size;
+
+	read_number(p, end, input_size);
+	read_number(p, end, output_size);
+	if (input_size != source_size && output_size == source_size) {
+		// the patch was made in the other direction
+		uint64_t tmp = input_size;
+		input_size = output_size;
+		output_size = tmp;
+	}
+	if (input_size != source_size || output_size != target_size) {
+		printf("warning: UPS patch size mismatch\n");
+		return false;
+	}
+
+	size_t offset = 0;
+	while (p < end) {
+		uint64_t skip;
+		if (!read_number(p, end, skip)) {
+			return false;
+		}
+		offset += skip;
+		while (p < end) {
+			uint8_t x = *p++;
+			if (!x) {
+				break;
+			}
+			if (offset < target_size) {
+				poke(target, offset, (offset < source_size ? source[offset] : 0) ^ x);
+			}
+			offset++;
+		}
+		offset++;
+	}
+
+	uint32_t crc = crc32(target, target_size);
+	if (crc != read32le(patch + patch_size - 8) && crc != read32le(patch + patch_size - 12)) {
+		printf("warning: UPS target checksum mismatch\n");
+		return false;
+	}
+	return true;
+}
+
+#pragma mark - BPS
+
+static bool
+bps_apply(const uint8_t *patch, size_t patch_size, const uint8_t *source, size_t source_size, uint8_t *target, size_t target_size)
+{
+	const uint8_t *p = patch + 4;
+	const uint8_t *end = patch + patch_size - 12;
+	uint64_t input_size, output_size, metadata_size;
+
+	read_number(p, end, input_size);
+	read_number(p, end, output_size);
+	read_number(p, end, metadata_size);
+	if (input_size != source_size || output_size != target_size) {
+		printf("warning: BPS patch size mismatch\n");
+		return false;
+	}
+	p += metadata_size;
+
+	size_t output_offset = 0;
+	int64_t source_relative_offset = 0;
+	int64_t target_relative_offset = 0;
+	while (p < end) {
+		uint64_t data;
+		if (!read_number(p, end, data)) {
+			return false;
+		}
+		uint64_t length = (data >> 2) + 1;
+		if (output_offset + length > target_size) {
+			return false;
+		}
+
+		switch (data & 3) {
+			case 0: /* SourceRead */
+				for (; length; length--, output_offset++) {
+					poke(target, output_offset, output_offset < source_size ? source[output_offset] : 0);
+				}
+				break;
+			case 1: /* TargetRead */
+				if (p + length > end) {
+					return false;
+				}
+				for (; length; length--) {
+					poke(target, output_offset++, *p++);
+				}
+				break;
+			case 2: /* SourceCopy */
+			case 3: /* TargetCopy */ {
+				uint64_t d;
+				if (!read_number(p, end, d)) {
+					return false;
+				}
+				int64_t delta = (d & 1 ? -1 : 1) * (int64_t)(d >> 1);
+				if (!(data & 1)) {
+					source_relative_offset += delta;
+					if (source_relative_offset < 0 || (uint64_t)source_relative_offset + length > source_size) {
+						return false;
+					}
+					for (; length; length--) {
+						poke(target, output_offset++, source[source_relative_offset++]);
+					}
+				} else {
+					target_relative_offset += delta;
+					if (target_relative_offset < 0 || (size_t)target_relative_offset >= output_offset) {
+						return false;
+					}
+					// may overlap the bytes being written (RLE)
+					for (; length; length--) {
+						poke(target, output_offset++, target[target_relative_offset++]);
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	if (output_offset != target_size) {
+		return false;
+	}
+	if (crc32(target, target_size) != read32le(patch + patch_size - 8)) {
+		printf("warning: BPS target checksum mismatch\n");
+		return false;
+	}
+	return true;
+}
+
+#pragma mark - Public
+
+size_t
+patch_target_size(const uint8_t *patch, size_t patch_size, size_t source_size)
+{
+	if (patch_size >= 8 && !memcmp(patch, "PATCH", 5)) {
+		return ips_target_size(patch, patch_size, source_size);
+	} else if (patch_size >= 16 && (!memcmp(patch, "UPS1", 4) || !memcmp(patch, "BPS1", 4))) {
+		const uint8_t *p = patch + 4;
+		const uint8_t *end = patch + patch_size - 12;
+		uint64_t input_size, output_size;
+		if (!read_number(p, end, input_size) || !read_number(p, end, output_size)) {
+			return 0;
+		}
+		if (patch[0] == 'U' && input_size != source_size && output_size == source_size) {
+			return input_size;
+		}
+		return output_size;
+	} else {
+		printf("warning: unknown patch format\n");
+		return 0;
+	}
+}
+
+bool
+patch_apply(const uint8_t *patch, size_t patch_size, const uint8_t *source, size_t source_size, uint8_t *target, size_t target_size)
+{
+	if (!memcmp(patch, "PATCH", 5)) {
+		return ips_apply(patch, patch_size, target, target_size);
+	}
+
+	if (crc32(patch, patch_size - 4) != read32le(patch + patch_size - 4)) {
+		printf("warning: patch checksum mismatch\n");
+		return false;
+	}
+	if (!memcmp(patch, "UPS1", 4)) {
+		uint32_t crc = crc32(source, source_size);
+		if (crc != read32le(patch + patch_size - 12) && crc != read32le(patch + patch_size - 8)) {
+			printf("warning: UPS source checksum mismatch\n");
+			return false;
+		}
+		return ups_apply(patch, patch_size, source, source_size, target, target_size);
+	} else {
+		if (crc32(source, source_size) != read32le(patch + patch_size - 12)) {
+			printf("warning: BPS source checksum mismatch\n");
+			return false;
+		}
+		return bps_apply(patch, patch_size, source, source_size, target, target_size);
+	}
+}
@@ -0,0 +1,23 @@
+//
+//  patch.h
+//  gbppu
+//
+
+#ifndef patch_h
+#define patch_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IPS, UPS and BPS patches are applied in two passes: the caller first asks
+// for the size of the patched image, prepares a buffer of that size that
+// already contains the source image, then applies the patch to it.
+// Bytes that the patch leaves unchanged are never written, so a target
+// buffer that is a private (copy-on-write) mapping of the source file only
+// gets the pages materialized that the patch actually touches.
+// If applying fails, the target may have been written partially.
+
+size_t patch_target_size(const uint8_t *patch, size_t patch_size, size_t source_size);
+bool patch_apply(const uint8_t *patch, size_t patch_size, const uint8_t *source, size_t source_size, uint8_t *target, size_t target_size);
+
+#endif /* patch_h */
@@ -0,0 +1,199 @@
+//
+//  pixels.cc
+//  gbppu
+//
+
+#include <string.h>
+#include "pixels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#pragma mark - Scalar
+
+void
+pixels_decode_2bpp_scalar(const uint8_t *planes, size_t rows, uint8_t *out, bool flipped)
+{
+	for (size_t r = 0; r < rows; r++) {
+		uint8_t data0 = planes[2 * r];
+		uint8_t data1 = planes[2 * r + 1];
+		for (int i = 0; i < 8; i++) {
+			int bit = flipped ? i : 7 - i;
+			out[8 * r + i] = ((data0 >> bit) & 1) | (((data1 >> bit) & 1) << 1);
+		}
+	}
+}
+
+void
+pixels_apply_palettes_scalar(const uint8_t *values, const uint8_t *sources, const uint8_t palettes[3], uint8_t *out, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		out[i] = (sources[i] << 2) | ((palettes[sources[i]] >> (values[i] << 1)) & 3);
+	}
+}
+
+void
+pixels_convert_scalar(const uint8_t *pixels, size_t count, const uint8_t lut[12][4], int bpp, uint8_t *out)
+{
+	for (size_t i = 0; i < count; i++) {
+		memcpy(out + i * bpp, lut[pixels[i]], bpp);
+	}
+}
+
+#pragma mark - Decode
+
+void
+pixels_decode_2bpp(const uint8_t *planes, size_t rows, uint8_t *out, bool flipped)
+{
+	size_t r = 0;
+#if defined(__SSE2__)
+	// two rows at a time: spread each plane byte over 8 lanes and test
+	// one bit per lane
+	const __m128i bits = flipped ?
+		_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128) :
+		_mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+	for (; r + 2 <= rows; r += 2) {
+		// lo0 hi0 lo1 hi1 -> 4 copies each -> 8 copies of lo0 and lo1,
+		// and of hi0 and hi1
+		int32_t pair;
+		memcpy(&pair, planes + 2 * r, 4);
+		__m128i x = _mm_cvtsi32_si128(pair);
+		x = _mm_unpacklo_epi8(x, x);
+		x = _mm_unpacklo_epi16(x, x);
+		__m128i p0 = _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128i p1 = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128i v0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p0, bits), bits), one);
+		__m128i v1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p1, bits), bits), two);
+		_mm_storeu_si128((__m128i *)(out + 8 * r), _mm_or_si128(v0, v1));
+	}
+#endif
+	pixels_decode_2bpp_scalar(planes + 2 * r, rows - r, out + 8 * r, flipped);
+}
+
+#pragma mark - Palettes
+
+#if defined(__SSE2__) && !defined(__SSSE3__)
+// 16 pixels: (palette >> (value * 2)) & 3, with the palette per pixel
+static inline __m128i
+shade16(__m128i value, __m128i palette)
+{
+	__m128i r = _mm_and_si128(_mm_cmpeq_epi8(value, _mm_setzero_si128()), palette);
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8(1)), _mm_srli_epi16(palette, 2)));
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8(2)), _mm_srli_epi16(palette, 4)));
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8(3)), _mm_srli_epi16(palette, 6)));
+	return _mm_and_si128(r, _mm_set1_epi8(3));
+}
+#endif
+
+void
+pixels_apply_palettes(const uint8_t *values, const uint8_t *sources, const uint8_t palettes[3], uint8_t *out, size_t count)
+{
+	size_t i = 0;
+
+	// all 12 results, indexed by source << 2 | value
+	uint8_t lut[16] = { 0 };
+	for (int s = 0; s < 3; s++) {
+		for (int v = 0; v < 4; v++) {
+			lut[s << 2 | v] = (s << 2) | ((palettes[s] >> (v << 1)) & 3);
+		}
+	}
+
+#if defined(__AVX2__)
+	__m256i lut32 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lut));
+	for (; i + 32 <= count; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sources + i));
+		__m256i index = _mm256_or_si256(_mm256_slli_epi16(s, 2), v);
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(lut32, index));
+	}
+#endif
+#if defined(__SSSE3__)
+	__m128i lut16 = _mm_loadu_si128((const __m128i *)lut);
+	for (; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(sources + i));
+		__m128i index = _mm_or_si128(_mm_slli_epi16(s, 2), v);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(lut16, index));
+	}
+#elif defined(__SSE2__)
+	// no byte shuffle: pick each pixel's palette, then shift per value
+	__m128i bgp = _mm_set1_epi8(palettes[0]);
+	__m128i obp0 = _mm_set1_epi8(palettes[1]);
+	__m128i obp1 = _mm_set1_epi8(palettes[2]);
+	for (; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(sources + i));
+		__m128i palette = _mm_and_si128(_mm_cmpeq_epi8(s, _mm_setzero_si128()), bgp);
+		palette = _mm_or_si128(palette, _mm_and_si128(_mm_cmpeq_epi8(s, _mm_set1_epi8(1)), obp0));
+		palette = _mm_or_si128(palette, _mm_and_si128(_mm_cmpeq_epi8(s, _mm_set1_epi8(2)), obp1));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_slli_epi16(s, 2), shade16(v, palette)));
+	}
+#endif
+
+	for (; i < count; i++) {
+		out[i] = lut[sources[i] << 2 | values[i]];
+	}
+}
+
+#pragma mark - Convert
+
+void
+pixels_convert(const uint8_t *pixels, size_t count, const uint8_t lut[12][4], int bpp, uint8_t *out)
+{
+	size_t i = 0;
+#if defined(__SSSE3__)
+	// one shuffle per byte of the output pixels, then interleave
+	__m128i plane[4];
+	for (int b = 0; b < bpp; b++) {
+		uint8_t bytes[16] = { 0 };
+		for (int j = 0; j < 12; j++) {
+			bytes[j] = lut[j][b];
+		}
+		plane[b] = _mm_loadu_si128((const __m128i *)bytes);
+	}
+	for (; i + 16 <= count; i += 16) {
+		__m128i index = _mm_loadu_si128((const __m128i *)(pixels + i));
+		__m128i p0 = _mm_shuffle_epi8(plane[0], index);
+		if (bpp == 1) {
+			_mm_storeu_si128((__m128i *)(out + i), p0);
+			continue;
+		}
+		__m128i p1 = _mm_shuffle_epi8(plane[1], index);
+		__m128i lo = _mm_unpacklo_epi8(p0, p1);
+		__m128i hi = _mm_unpackhi_epi8(p0, p1);
+		if (bpp == 2) {
+			_mm_storeu_si128((__m128i *)(out + 2 * i), lo);
+			_mm_storeu_si128((__m128i *)(out + 2 * i + 16), hi);
+			continue;
+		}
+		__m128i p2 = _mm_shuffle_epi8(plane[2], index);
+		__m128i p3 = _mm_shuffle_epi8(plane[3], index);
+		__m128i lo23 = _mm_unpacklo_epi8(p2, p3);
+		__m128i hi23 = _mm_unpackhi_epi8(p2, p3);
+		uint8_t *o = out + 4 * i;
+		_mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi16(lo, lo23));
+		_mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi16(lo, lo23));
+		_mm_storeu_si128((__m128i *)(o + 32), _mm_unpacklo_epi16(hi, hi23));
+		_mm_storeu_si128((__m128i *)(o + 48), _mm_unpackhi_epi16(hi, hi23));
+	}
+#endif
+	switch (bpp) {
+		case 1:
+			for (; i < count; i++) {
+				out[i] = lut[pixels[i]][0];
+			}
+			break;
+		default:
+			pixels_convert_scalar(pixels + i, count - i, lut, bpp, out + i * bpp);
+			break;
+	}
+}
@@ -0,0 +1,29 @@
+//
+//  pixels.h
+//  gbppu
+//
+
+#ifndef pixels_h
+#define pixels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel kernels for the renderers, vectorized where the CPU allows it.
+// The _scalar versions are the reference implementations.
+
+// rows of 2 bitplane bytes each -> 8 pixels (0-3) per row, leftmost
+// first, or rightmost first if flipped
+void pixels_decode_2bpp(const uint8_t *planes, size_t rows, uint8_t *out, bool flipped);
+void pixels_decode_2bpp_scalar(const uint8_t *planes, size_t rows, uint8_t *out, bool flipped);
+
+// pixel values (0-3) from a source (source_bg, source_obj0, source_obj1)
+// -> source << 2 | shade through BGP, OBP0 or OBP1
+void pixels_apply_palettes(const uint8_t *values, const uint8_t *sources, const uint8_t palettes[3], uint8_t *out, size_t count);
+void pixels_apply_palettes_scalar(const uint8_t *values, const uint8_t *sources, const uint8_t palettes[3], uint8_t *out, size_t count);
+
+// source << 2 | shade -> pixels of 1, 2 or 4 bytes from a table
+void pixels_convert(const uint8_t *pixels, size_t count, const uint8_t lut[12][4], int bpp, uint8_t *out);
+void pixels_convert_scalar(const uint8_t *pixels, size_t count, const uint8_t lut[12][4], int bpp, uint8_t *out);
+
+#endif /* pixels_h */
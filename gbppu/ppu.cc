@@ -12,14 +12,24 @@
 #include "ppu.h"
 #include "memory.h"
 #include "io.h"
+#include "pixels.h"
 #include <string.h>
 
-#undef DEBUG
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// render lines that the CPU doesn't observe in one go; build with
+// NO_FAST_LINES to always use the pixel FIFO
+#if !defined(FAST_LINES) && !defined(NO_FAST_LINES)
+#define FAST_LINES
+#endif
 
 #define PPU_NUM_LINES 154
 #define PPU_NUM_VISIBLE_LINES 144
 #define PPU_NUM_VISIBLE_PIXELS_PER_LINE 160
 #define PPU_CLOCKS_PER_LINE (114*4)
+#define PPU_OAM_SEARCH_CLOCKS (40*2)
 
 #define LCDCF_ON      (1 << 7) /* LCD Control Operation */
 #define LCDCF_WIN9C00 (1 << 6) /* Window Tile Map Display Select */
@@ -32,6 +42,7 @@
 
 #pragma mark - Debug
 
+#ifdef PPU_DEBUG_STRINGS
 void ppu::
 debug_init()
 {
@@ -66,33 +77,65 @@ debug_fetch(char c)
 void ppu::
 debug_flush()
 {
-#ifdef DEBUG
 	if (*debug_string_pixel) {
 		printf("PIX:%s\n", debug_string_pixel);
 		printf("FET:%s\n", debug_string_fetch);
 	}
-#endif
 	debug_init();
 }
+#else
+#define debug_init()
+#define debug_pixel(c)
+#define debug_fetch(c)
+#define debug_flush()
+#endif
+
+#ifdef PPU_TRACE
+void ppu::
+trace_add(ppu_trace_type_t type, uint16_t data)
+{
+	ppu_trace_entry_t *e = &trace[trace_count++ & (PPU_TRACE_SIZE - 1)];
+	e->cycle = synced;
+	e->data = data;
+	e->dot = clock;
+	e->line = line;
+	e->type = type;
+}
+#define TRACE(type, data) trace_add(type, data)
+#else
+#define TRACE(type, data)
+#endif
+
+size_t ppu::
+dump_trace(FILE *file)
+{
+#ifdef PPU_TRACE
+	uint64_t first = trace_count > PPU_TRACE_SIZE ? trace_count - PPU_TRACE_SIZE : 0;
+	for (uint64_t i = first; i < trace_count; i++) {
+		fwrite(&trace[i & (PPU_TRACE_SIZE - 1)], sizeof(ppu_trace_entry_t), 1, file);
+	}
+	return trace_count - first;
+#else
+	return 0;
+#endif
+}
+
+void ppu::
+reset_trace()
+{
+#ifdef PPU_TRACE
+	trace_count = 0;
+#endif
+}
 
 
 #pragma mark - I/O
 
+// all other registers behave like RAM and are handled by io
 uint8_t ppu::
 io_read(uint8_t a8)
 {
 	switch (a8) {
-		case rLCDC: /* 0x40 */
-		case rSCY:  /* 0x42 */
-		case rSCX:  /* 0x43 */
-		case rLYC:  /* 0x45 */
-		case rDMA:  /* 0x46 */
-		case rBGP:  /* 0x47 */
-		case rOBP0: /* 0x48 */
-		case rOBP1: /* 0x49 */
-		case rWY:   /* 0x4A */
-		case rWX:   /* 0x4B */
-			return _io.reg[a8];
 		case rSTAT: /* 0x41 */
 			return (_io.reg[a8] & 0xFC) | mode;
 		case rLY:   /* 0x44 */
@@ -104,16 +147,28 @@ io_read(uint8_t a8)
 void ppu::
 io_write(uint8_t a8, uint8_t d8)
 {
+	switch (a8) {
+		case rLCDC:
+		case rSCY:
+		case rSCX:
+		case rBGP:
+		case rOBP0:
+		case rOBP1:
+		case rWY:
+		case rWX:
+			if (_io.reg[a8] != d8) {
+				// lines that are still to be drawn used the old value
+				flush_lines();
+			}
+			break;
+	}
+	if (a8 == rLCDC && (_io.reg[a8] ^ d8) & LCDCF_OBJ16) {
+		oam_uncache();
+	}
+
 	_io.reg[a8] = d8;
 
 	switch (a8) {
-		case rLCDC: /* 0x40 */
-		case rSTAT: /* 0x41 */
-		case rSCY:  /* 0x42 */
-		case rSCX:  /* 0x43 */
-		case rLY:   /* 0x44 */
-		case rLYC:  /* 0x45 */
-			break;
 		case rDMA: {/* 0x46 */
 			// TODO this should take a while and block access
 			// to certain memory areas
@@ -122,16 +177,10 @@ io_write(uint8_t a8, uint8_t d8)
 			}
 			break;
 		}
-		case rBGP:  /* 0x47 */
-		case rOBP0: /* 0x48 */
-		case rOBP1: /* 0x49 */
-		case rWY:   /* 0x4A */
-		case rWX:   /* 0x4B */
-			break;
-		default:
-			printf("warning: ppu I/O write %s 0xff%02x <- 0x%02x\n", name_for_io_reg(a8), a8, d8);
-			break;
 	}
+
+	// LCDC, STAT and LYC decide when the next interrupt happens
+	schedule();
 }
 
 
@@ -140,32 +189,61 @@ io_write(uint8_t a8, uint8_t d8)
 uint8_t ppu::
 vram_read(uint16_t a16)
 {
+	sync();
 	return vram_locked ? 0xff : vram[a16];
 }
 
 void ppu::
 vram_write(uint16_t a16, uint8_t d8)
 {
-	if (!vram_locked) {
+	sync();
+	if (!vram_locked && vram[a16] != d8) {
+		flush_lines();
 		vram[a16] = d8;
+		if (a16 < sizeof(tiles) / sizeof(*tiles) * 16) {
+			decode_tile_row(a16);
+		}
 	}
 }
 
 uint8_t ppu::
 oamram_read(uint8_t a8)
 {
+	sync();
 	return oamram_locked ? 0xff : oamram[a8];
 }
 
 void ppu::
 oamram_write(uint8_t a8, uint8_t d8)
 {
-	if (!oamram_locked) {
+	sync();
+	if (!oamram_locked && oamram[a8] != d8) {
+		flush_lines();
 		oamram[a8] = d8;
 	}
 }
 
 
+void ppu::
+decode_tile_row(uint16_t a16)
+{
+	const uint8_t *planes = &vram[a16 & ~1];
+	unsigned tile = a16 >> 4, y = (a16 >> 1) & 7;
+	pixels_decode_2bpp(planes, 1, tiles[tile][y], false);
+	pixels_decode_2bpp(planes, 1, tiles_flipped[tile][y], true);
+}
+
+// Both caches are laid out like tile data in VRAM, one row of 2 bytes
+// turning into 8 bytes, so they can be rebuilt in one go.
+void ppu::
+decode_tiles()
+{
+	size_t rows = sizeof(tiles) / sizeof(**tiles);
+	pixels_decode_2bpp(vram, rows, &tiles[0][0][0], false);
+	pixels_decode_2bpp(vram, rows, &tiles_flipped[0][0][0], true);
+}
+
+
 #pragma mark - Init
 
 ppu::
@@ -176,8 +254,21 @@ ppu(memory &memory, io &io)
 	vram = (uint8_t *)calloc(0x2000, 1);
 	oamram = (uint8_t *)calloc(0xa0, 1);
 
+	synced = 0;
 	clock_even = false;
 	screen_off = true;
+
+	pending_count = 0;
+	frame_fifo_lines = 0;
+	frame_skip = 0;
+	fast_lines = true;
+	skipped = 0;
+	render = true;
+	frame_flushes = 0;
+	memset(&stats, 0, sizeof(stats));
+	reset_trace();
+
+	decode_tiles();
 }
 
 void ppu::
@@ -185,7 +276,17 @@ screen_reset()
 {
 	line = 0;
 	clock = 0;
-	ppicture = (uint8_t *)picture;
+
+	// whether a frame is drawn is decided at its start
+	if (frame_skip < 0) {
+		render = false;
+	} else if (skipped >= frame_skip) {
+		render = true;
+		skipped = 0;
+	} else {
+		render = false;
+		skipped++;
+	}
 
 	debug_init();
 
@@ -241,6 +342,36 @@ get_sprite_height()
 	return _io.reg[rLCDC] & LCDCF_OBJ16 ? 16 : 8;
 }
 
+// Bit i is set for every OAM entry i that is on the line: X isn't 0,
+// and the line is within the sprite's height.
+static uint64_t
+oam_search_all(const uint8_t *oam, int line, int height)
+{
+	uint64_t mask = 0;
+	int i = 0;
+#if defined(__SSE2__)
+	// 4 entries at a time; (line + 16 - Y) & 0xff < height
+	const __m128i byte = _mm_set1_epi32(0xff);
+	const __m128i vline = _mm_set1_epi32(line + 16);
+	const __m128i vheight = _mm_set1_epi32(height);
+	for (; i < 40; i += 4) {
+		__m128i e = _mm_loadu_si128((const __m128i *)(oam + 4 * i));
+		__m128i dy = _mm_and_si128(_mm_sub_epi32(vline, _mm_and_si128(e, byte)), byte);
+		__m128i on_line = _mm_cmplt_epi32(dy, vheight);
+		__m128i x_zero = _mm_cmpeq_epi32(_mm_and_si128(_mm_srli_epi32(e, 8), byte), _mm_setzero_si128());
+		int m = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(x_zero, on_line)));
+		mask |= (uint64_t)m << i;
+	}
+#endif
+	for (; i < 40; i++) {
+		uint8_t dy = line + 16 - oam[4 * i];
+		if (oam[4 * i + 1] && dy < height) {
+			mask |= 1ULL << i;
+		}
+	}
+	return mask;
+}
+
 void ppu::
 oam_reset()
 {
@@ -252,9 +383,45 @@ oam_reset()
 	oam_out_counter = 0;
 	oam_t = 0;
 
+	// OAM is locked until the end of mode 3, so only a change of the
+	// sprite height can make this wrong
+	uint64_t mask = oam_search_all(oamram, line, get_sprite_height());
 	for (int i = 0; i < 10; i++) {
+		if (mask) {
+			active_sprite_index[i] = __builtin_ctzll(mask);
+			mask &= mask - 1;
+		} else {
+			active_sprite_index[i] = -1;
+		}
+	}
+	oam_cached = true;
+}
+
+// The sprite height is about to change during the OAM search: the
+// entries looked at so far keep their results, and the rest is
+// searched dot by dot.
+void ppu::
+oam_uncache()
+{
+	if (mode != mode_oam || !oam_cached) {
+		return;
+	}
+	oam_cached = false;
+
+	oam_out_counter = 0;
+	while (oam_out_counter < 10 &&
+		   active_sprite_index[oam_out_counter] >= 0 &&
+		   active_sprite_index[oam_out_counter] < oam_counter) {
+		oam_out_counter++;
+	}
+	for (int i = oam_out_counter; i < 10; i++) {
 		active_sprite_index[i] = -1;
 	}
+	if (oam_t == 1) {
+		// the first half of the current entry has been done
+		oamentry *oam = (oamentry *)oamram + oam_counter;
+		oam_candidate = oam->x && line >= oam->y - 16;
+	}
 }
 
 void ppu::
@@ -262,22 +429,27 @@ oam_step()
 {
 	oamentry *oam = (oamentry *)oamram;
 
-	switch (oam_t) {
-		case 0: {
-			int spry = oam[oam_counter].y - 16;
-			oam_candidate = oam[oam_counter].x && line >= spry;
-			oam_t = 1;
-			break;
-		}
-		case 1: {
-			int spry = oam[oam_counter].y - 16;
-			oam_candidate &= line < spry + get_sprite_height();
-			if (oam_candidate && oam_out_counter < 10) {
-				active_sprite_index[oam_out_counter++] = oam_counter;
+	if (oam_cached) {
+		oam_counter += oam_t;
+		oam_t ^= 1;
+	} else {
+		switch (oam_t) {
+			case 0: {
+				int spry = oam[oam_counter].y - 16;
+				oam_candidate = oam[oam_counter].x && line >= spry;
+				oam_t = 1;
+				break;
+			}
+			case 1: {
+				int spry = oam[oam_counter].y - 16;
+				oam_candidate &= line < spry + get_sprite_height();
+				if (oam_candidate && oam_out_counter < 10) {
+					active_sprite_index[oam_out_counter++] = oam_counter;
+				}
+				oam_counter++;
+				oam_t = 0;
+				break;
 			}
-			oam_counter++;
-			oam_t = 0;
-			break;
 		}
 	}
 
@@ -293,33 +465,58 @@ void ppu::
 pixel_reset()
 {
 	mode = mode_pixel;
+#ifdef PPU_TRACE
+	mode3_start = clock;
+#endif
 	vram_locked = true;
 	oamram_locked = true;
 
 	skip = 8 | (_io.reg[rSCX] & 7);
 	pixel_x = -(_io.reg[rSCX] & 7);
 
-	for (int i = 0; i < 16; i++) {
-		bg_pixel_queue[i] = { 0, source_invalid };
-	}
+	fifo_lo = 0;
+	fifo_hi = 0;
+	fifo_obj = 0;
+	fifo_obj1 = 0;
+	fifo_invalid = 0xffff;
 	bg_count = 0;
 	bg_index_ctr = 0;
 	bg_t = 0;
 	window = 0;
+	pline = line_buffer;
+
+	// sprites in order of X; the same X in order of the slot
+	oamentry *oam = (oamentry *)oamram;
+	sprite_count = 0;
+	sprite_next = 0;
+	for (int i = 0; i < 10 && active_sprite_index[i] >= 0; i++) {
+		int j = sprite_count++;
+		uint8_t x = oam[active_sprite_index[i]].x;
+		for (; j > 0 && oam[active_sprite_index[sprite_order[j - 1]]].x > x; j--) {
+			sprite_order[j] = sprite_order[j - 1];
+		}
+		sprite_order[j] = i;
+	}
 }
 
 int ppu::
 sprite_starts_here()
 {
-	// The real hardware uses 10 parallel comparators for this
+	// The real hardware uses 10 parallel comparators for this; the
+	// sprites are sorted by X, so only the first one can match
 	if (!(_io.reg[rLCDC] & LCDCF_OBJON)) {
 		return -1;
 	}
-	for (int i = 0; i < 10; i++) {
+	while (sprite_next < sprite_count) {
+		int i = sprite_order[sprite_next];
 		int8_t index = active_sprite_index[i];
-		if (index >= 0 && ((oamentry *)oamram)[index].x == pixel_x) {
-			return i;
+		// skip the ones fetched already, and the ones passed while
+		// sprites were off
+		if (index < 0 || ((oamentry *)oamram)[index].x < pixel_x) {
+			sprite_next++;
+			continue;
 		}
+		return ((oamentry *)oamram)[index].x == pixel_x ? i : -1;
 	}
 	return -1;
 }
@@ -329,10 +526,15 @@ pixel_step()
 {
 	if (pixel_x == PPU_NUM_VISIBLE_PIXELS_PER_LINE + 8) {
 		// we have enough pixels for the line -> end this mode
+		TRACE(ppu_trace_mode3, clock - mode3_start);
+		if (render) {
+			frames.put_line(line, line_buffer);
+		}
 		hblank_reset();
 	} else if ((sprite_index = sprite_starts_here()) >= 0) {
 		// we can't shift out pixels because a sprite starts at this position -> fetch a sprite
 		debug_pixel('s');
+		TRACE(ppu_trace_sprite, active_sprite_index[sprite_index]);
 		cur_oam = &((oamentry *)oamram)[active_sprite_index[sprite_index]];
 		line_within_tile = line - cur_oam->y + 16;
 		if (cur_oam->attr & 0x40) { // Y flip
@@ -345,6 +547,7 @@ pixel_step()
 	} else if (!window && _io.reg[rLCDC] & LCDCF_WINON && line >= _io.reg[rWY] && pixel_x + 8 == _io.reg[rWX]) {
 		// the window starts at this position -> clear pixel buffer, switch to window fetches
 		debug_pixel('w');
+		TRACE(ppu_trace_window, pixel_x + 8);
 		window = 1;
 		bg_t = 0;
 		bg_count = 0;
@@ -354,28 +557,44 @@ pixel_step()
 		debug_pixel('_');
 	} else {
 		// output a pixel
-		pixel_t pixel = bg_pixel_queue[0];
-		memmove(bg_pixel_queue, bg_pixel_queue + 1, 15);
+		uint8_t value = (fifo_lo >> 15) | ((fifo_hi >> 15) << 1);
+		uint8_t source = fifo_invalid & 0x8000 ? source_invalid :
+						 !(fifo_obj & 0x8000) ? source_bg :
+						 fifo_obj1 & 0x8000 ? source_obj1 :
+						 source_obj0;
+		// the last entry stays as it is
+		fifo_lo = (fifo_lo << 1) | (fifo_lo & 1);
+		fifo_hi = (fifo_hi << 1) | (fifo_hi & 1);
+		fifo_obj = (fifo_obj << 1) | (fifo_obj & 1);
+		fifo_obj1 = (fifo_obj1 << 1) | (fifo_obj1 & 1);
+		fifo_invalid = (fifo_invalid << 1) | (fifo_invalid & 1);
 		bg_count--;
-		uint8_t palette_reg = pixel.source == source_obj0 ? rOBP0 :
-							  pixel.source == source_obj1 ? rOBP1 :
-							  rBGP;
+		// BGP, OBP0 or OBP1
+		uint8_t palette = source == source_invalid ? (uint8_t)source_bg : source;
 		if (skip) {
 			// the pixel is skipped because of SCX
 			debug_pixel('-');
 			--skip;
 		} else {
-			debug_pixel(pixel.source == source_invalid ? '*' : pixel.source == source_bg ? pixel.value + '0' : pixel.value + 'A');
+			debug_pixel(source == source_invalid ? '*' : source == source_bg ? value + '0' : value + 'A');
 
-			if (pixel_x >= 8) {
-				assert(ppicture - (uint8_t *)picture < sizeof(picture));
-				*ppicture++ = (_io.reg[palette_reg] >> (pixel.value << 1)) & 3;
+			if (pixel_x >= 8 && render) {
+				assert(pline - line_buffer < PPU_NUM_VISIBLE_PIXELS_PER_LINE);
+				*pline++ = (palette << 2) | ((_io.reg[rBGP + palette] >> (value << 1)) & 3);
 			}
 		}
 		pixel_x++;
 	}
 }
 
+static inline uint8_t
+reverse_bits(uint8_t b)
+{
+	b = (b >> 4) | (b << 4);
+	b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+	return ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+}
+
 void ppu::
 fetch_step()
 {
@@ -418,6 +637,7 @@ fetch_step()
 			debug_fetch(fetch_is_sprite ? 'B' : 'b');
 			// T1: read index, generate tile data address and prepare reading tile data #0
 			uint8_t index = fetch_is_sprite ? cur_oam->tile : vram_get_data();
+			TRACE(ppu_trace_fetch, index | (window << 8) | (fetch_is_sprite << 9));
 			if (fetch_is_sprite || (_io.reg[rLCDC] & LCDCF_BG8000)) {
 				bgptr = index * 16;
 			} else {
@@ -445,19 +665,35 @@ fetch_step()
 				break;
 			}
 			uint8_t data1 = vram_get_data();
-			for (int i = 7; i >= 0; i--) {
-				uint8_t value = ((data0 >> i) & 1) | (((data1 >> i) & 1) << 1);
-				if (fetch_is_sprite) {
-					uint8_t i2 = (cur_oam->attr & 0x20) ? i : 7 - i; // flip
-					if (value && // don't draw transparent sprite pixels
-						bg_pixel_queue[i2].source == source_bg && // don't draw over other sprites
-						(!(cur_oam->attr & 0x80) || !bg_pixel_queue[i2].value)) { // don't draw if behind bg pixels
-						bg_pixel_queue[i2] = { value, (unsigned char)(cur_oam->attr & 0x10 ? source_obj1 : source_obj0) };
-					}
+			if (fetch_is_sprite) {
+				// merge into the front 8 pixels
+				uint16_t lo = data0 << 8;
+				uint16_t hi = data1 << 8;
+				if (cur_oam->attr & 0x20) { // flip
+					lo = reverse_bits(data0) << 8;
+					hi = reverse_bits(data1) << 8;
+				}
+				uint16_t mask = (lo | hi) & // don't draw transparent sprite pixels
+					~(fifo_obj | fifo_invalid); // don't draw over other sprites
+				if (cur_oam->attr & 0x80) {
+					mask &= ~(fifo_lo | fifo_hi); // don't draw if behind bg pixels
+				}
+				fifo_lo = (fifo_lo & ~mask) | (lo & mask);
+				fifo_hi = (fifo_hi & ~mask) | (hi & mask);
+				fifo_obj |= mask;
+				if (cur_oam->attr & 0x10) {
+					fifo_obj1 |= mask;
 				} else {
-					bg_pixel_queue[8 + (7 - i)] = { value, source_bg };
-					bg_count++;
+					fifo_obj1 &= ~mask;
 				}
+			} else {
+				// fill the back 8 pixels
+				fifo_lo = (fifo_lo & 0xff00) | data0;
+				fifo_hi = (fifo_hi & 0xff00) | data1;
+				fifo_obj &= 0xff00;
+				fifo_obj1 &= 0xff00;
+				fifo_invalid &= 0xff00;
+				bg_count += 8;
 			}
 			if (fetch_is_sprite) {
 				active_sprite_index[sprite_index] = -1;
@@ -472,6 +708,156 @@ fetch_step()
 }
 
 
+#pragma mark - Scanline Renderer
+
+// Renders a line at once, with the same results as running
+// pixel_step()/fetch_step() through mode 3 with the current registers,
+// VRAM and OAM, and the sprites found by the OAM search.
+void ppu::
+render_line(int y, const int8_t *sprites, uint8_t *out)
+{
+	uint8_t lcdc = _io.reg[rLCDC];
+	uint8_t scx = _io.reg[rSCX];
+	uint8_t scy = _io.reg[rSCY];
+	uint8_t bg[PPU_NUM_VISIBLE_PIXELS_PER_LINE];
+	uint8_t source[PPU_NUM_VISIBLE_PIXELS_PER_LINE];
+
+	// the window starts WX - 8 pixels into the line, if the FIFO
+	// gets there; it never reaches its first SCX & 7 positions
+	int window_x = PPU_NUM_VISIBLE_PIXELS_PER_LINE;
+	if (lcdc & LCDCF_WINON && y >= _io.reg[rWY]) {
+		int wx = _io.reg[rWX] - 8;
+		if (wx >= -(scx & 7) && wx < PPU_NUM_VISIBLE_PIXELS_PER_LINE + 8) {
+			window_x = wx;
+		}
+	}
+
+	// background and window
+	for (int x = 0; x < PPU_NUM_VISIBLE_PIXELS_PER_LINE; ) {
+		uint8_t xbase, ybase, index_ram_select_mask;
+		int px;
+		if (x >= window_x) {
+			px = x - window_x;
+			xbase = px >> 3;
+			ybase = y - _io.reg[rWY];
+			index_ram_select_mask = LCDCF_WIN9C00;
+		} else {
+			px = (scx + x) & 255;
+			xbase = px >> 3;
+			ybase = scy + y;
+			index_ram_select_mask = LCDCF_BG9C00;
+		}
+		uint16_t charaddr = 0x1800 | (!!(lcdc & index_ram_select_mask) << 10) | ((ybase >> 3) << 5) | xbase;
+		uint8_t index = vram[charaddr];
+		int tile = (lcdc & LCDCF_BG8000) ? index : 256 + (int8_t)index;
+		const uint8_t *row = tiles[tile][ybase & 7];
+
+		// the rest of this tile, or up to where the window starts
+		int end = x + 8 - (px & 7);
+		if (x < window_x && end > window_x) {
+			end = window_x;
+		}
+		if (end > PPU_NUM_VISIBLE_PIXELS_PER_LINE) {
+			end = PPU_NUM_VISIBLE_PIXELS_PER_LINE;
+		}
+		for (int i = px & 7; x < end; x++, i++) {
+			bg[x] = row[i];
+			source[x] = source_bg;
+		}
+	}
+
+	// sprites, in the order the FIFO fetches them: by X, then by OAM index
+	if (lcdc & LCDCF_OBJON) {
+		int order[10];
+		int count = 0;
+		for (int i = 0; i < 10; i++) {
+			int8_t index = sprites[i];
+			if (index < 0 || ((oamentry *)oamram)[index].x >= PPU_NUM_VISIBLE_PIXELS_PER_LINE + 8) {
+				continue;
+			}
+			int j = count++;
+			while (j && ((oamentry *)oamram)[order[j - 1]].x > ((oamentry *)oamram)[index].x) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = index;
+		}
+
+		for (int i = 0; i < count; i++) {
+			oamentry *oam = &((oamentry *)oamram)[order[i]];
+			uint8_t sprite_y = y - oam->y + 16;
+			if (oam->attr & 0x40) { // Y flip
+				sprite_y = get_sprite_height() - sprite_y - 1;
+			}
+			// 8x16 sprites continue into the next tile
+			int tile = oam->tile + (sprite_y >> 3);
+			const uint8_t *row = (oam->attr & 0x20 ? tiles_flipped : tiles)[tile][sprite_y & 7];
+			uint8_t obj_source = oam->attr & 0x10 ? source_obj1 : source_obj0;
+			for (int c = 0; c < 8; c++) {
+				int x = oam->x - 8 + c;
+				if (x < 0 || x >= PPU_NUM_VISIBLE_PIXELS_PER_LINE) {
+					continue;
+				}
+				uint8_t value = row[c];
+				if (value && // don't draw transparent sprite pixels
+					source[x] == source_bg && // don't draw over other sprites
+					(!(oam->attr & 0x80) || !bg[x])) { // don't draw if behind bg pixels
+					bg[x] = value;
+					source[x] = obj_source;
+				}
+			}
+		}
+	}
+
+	uint8_t palette[3] = { _io.reg[rBGP], _io.reg[rOBP0], _io.reg[rOBP1] };
+	pixels_apply_palettes(bg, source, palette, out, PPU_NUM_VISIBLE_PIXELS_PER_LINE);
+}
+
+// Draws the lines whose mode 3 nobody has seen yet. This has to happen
+// before anything they depend on changes, and at V-Blank. If nothing
+// changes during a frame, the whole frame is drawn in one pass.
+void ppu::
+flush_lines()
+{
+	if (!pending_count) {
+		return;
+	}
+	// not line_buffer: the FIFO may be in the middle of a line
+	uint8_t out[PPU_NUM_VISIBLE_PIXELS_PER_LINE];
+	for (int i = 0; i < pending_count; i++) {
+		int l = pending_lines[i];
+		render_line(l, pending_sprites[l], out);
+		frames.put_line(l, out);
+	}
+	stats.lines_fast += pending_count;
+	pending_count = 0;
+	frame_flushes++;
+}
+
+void ppu::
+frame_done()
+{
+	if (!render) {
+		stats.frames_skipped++;
+		frame_fifo_lines = 0;
+		return;
+	}
+
+	flush_lines();
+	if (frame_fifo_lines) {
+		stats.frames_fifo++;
+	} else if (frame_flushes == 1) {
+		stats.frames_whole++;
+	} else if (frame_flushes) {
+		stats.frames_lines++;
+	}
+	stats.lines_fifo += frame_fifo_lines;
+	frame_fifo_lines = 0;
+	frame_flushes = 0;
+
+	frames.publish();
+}
+
 #pragma mark - IRQ
 
 void ppu::
@@ -546,6 +932,9 @@ step()
 		if (line < PPU_NUM_VISIBLE_LINES) {
 			oam_reset();
 		} else if (line <= PPU_NUM_LINES) {
+			if (line == PPU_NUM_VISIBLE_LINES) {
+				frame_done();
+			}
 			vblank_reset();
 		} else  {
 			screen_reset();
@@ -554,3 +943,116 @@ step()
 	}
 
 }
+
+// Catches up with the CPU; called for interrupts, at the end of a frame
+// and before any access to PPU registers, VRAM or OAM. Most of H-Blank
+// and V-Blank is just counting dots, so those are skipped in one go.
+void ppu::
+sync()
+{
+	uint64_t target = _io.cycle;
+
+	if (synced == target) {
+		return;
+	}
+
+	while (synced < target) {
+		uint64_t n = target - synced;
+		if (screen_off && !(_io.reg[rLCDC] & LCDCF_ON)) {
+			clock_even ^= n & 1;
+			synced = target;
+			break;
+		}
+		if ((mode == mode_hblank || mode == mode_vblank) && mode == old_mode && clock) {
+			// nothing happens until the last dot of the line
+			uint64_t idle = PPU_CLOCKS_PER_LINE - 1 - clock;
+			if (idle) {
+				if (n > idle) {
+					n = idle;
+				}
+				clock += n;
+				clock_even ^= n & 1;
+				synced += n;
+				continue;
+			}
+		}
+		if (mode == mode_oam && mode == old_mode && clock && oam_cached) {
+			// the search has been done already; skip to its last dot
+			uint64_t idle = PPU_OAM_SEARCH_CLOCKS - 1 - clock;
+			if (idle) {
+				if (n > idle) {
+					n = idle;
+				}
+				clock += n;
+				clock_even ^= n & 1;
+				synced += n;
+				oam_counter = clock >> 1;
+				oam_t = clock & 1;
+				continue;
+			}
+		}
+		if (mode == mode_pixel && old_mode == mode_oam) {
+#ifdef FAST_LINES
+			if (fast_lines && !(_io.reg[rSTAT] & 0x08) && synced + PPU_CLOCKS_PER_LINE - clock <= target) {
+				// nothing can see mode 3 of this line: draw it later, when
+				// flush_lines() is called, and skip to the last dot of the
+				// line, which ends it
+				TRACE(ppu_trace_fast, 0);
+				if (render) {
+					pending_lines[pending_count++] = line;
+					memcpy(pending_sprites[line], active_sprite_index, sizeof(active_sprite_index));
+				}
+				hblank_reset();
+				old_mode = mode;
+				pixel_x = PPU_NUM_VISIBLE_PIXELS_PER_LINE + 8;
+				n = PPU_CLOCKS_PER_LINE - 1 - clock;
+				clock += n;
+				clock_even ^= n & 1;
+				synced += n;
+				continue;
+			}
+#endif
+			frame_fifo_lines++;
+		}
+		step();
+		synced++;
+	}
+
+	schedule();
+}
+
+// Schedules the next cycle at which the PPU may raise an interrupt or
+// finish a frame; until then, it only runs when the CPU looks at it.
+// Being early is harmless.
+void ppu::
+schedule()
+{
+	uint64_t next;
+	uint8_t stat = _io.reg[rSTAT];
+
+	if (screen_off && !(_io.reg[rLCDC] & LCDCF_ON)) {
+		next = EVENT_NEVER;
+	} else if (screen_off != !(_io.reg[rLCDC] & LCDCF_ON) || mode != old_mode || !clock) {
+		// the next dot switches the screen or may raise interrupts
+		next = synced + 1;
+	} else if (stat & 0x08 && mode == mode_oam) {
+		// H-Blank interrupt: two dots per OAM entry
+		next = synced + PPU_OAM_SEARCH_CLOCKS - clock;
+	} else if (stat & 0x08 && mode == mode_pixel) {
+		// H-Blank interrupt: at most one pixel per dot
+		next = synced + PPU_NUM_VISIBLE_PIXELS_PER_LINE + 8 - pixel_x + 1;
+	} else {
+		// the first line that starts with an interrupt, or the end of the frame
+		uint64_t dots = PPU_CLOCKS_PER_LINE - clock;
+		for (int l = line + 1; l <= PPU_NUM_LINES; l++, dots += PPU_CLOCKS_PER_LINE) {
+			if (l == PPU_NUM_VISIBLE_LINES ||
+				(l < PPU_NUM_VISIBLE_LINES && stat & (0x20 | 0x08)) ||
+				(stat & 0x40 && l == _io.reg[rLYC])) {
+				break;
+			}
+		}
+		next = synced + dots + 1;
+	}
+
+	_io.schedule(event_ppu, next);
+}
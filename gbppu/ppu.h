@@ -10,6 +10,14 @@
 #define ppu_h
 
 #include <stdio.h>
+#include "framebuffer.h"
+
+// define to log what the pixel pipeline does per dot, as text
+//#define PPU_DEBUG_STRINGS
+// define to record mode 3 lengths, fetches, sprites and window starts
+//#define PPU_TRACE
+
+#define PPU_TRACE_SIZE 65536 /* entries, power of two */
 
 class memory;
 class io;
@@ -21,10 +29,30 @@ enum {
 	source_invalid,
 };
 
+typedef enum {
+	ppu_trace_mode3,  // data: length of mode 3 in dots
+	ppu_trace_fast,   // mode 3 was skipped, the line is drawn in one go
+	ppu_trace_fetch,  // data: tile index, | 0x100 window, | 0x200 sprite
+	ppu_trace_sprite, // data: OAM entry
+	ppu_trace_window, // data: X position (+ 8)
+} ppu_trace_type_t;
+
+typedef struct {
+	uint64_t cycle;
+	uint16_t data;
+	uint16_t dot;
+	uint8_t line;
+	uint8_t type;
+} ppu_trace_entry_t;
+
 typedef struct {
-	unsigned char value : 2;
-	unsigned char source : 2;
-} pixel_t;
+	uint64_t frames_whole; // drawn in one pass at V-Blank
+	uint64_t frames_lines; // drawn in several batches of lines
+	uint64_t frames_fifo;  // at least one line went through the FIFO
+	uint64_t frames_skipped;
+	uint64_t lines_fast;
+	uint64_t lines_fifo;
+} ppu_stats_t;
 
 class ppu {
 private:
@@ -38,6 +66,7 @@ protected:
 
 public:
 	void step();
+	void sync();
 
 	uint8_t io_read(uint8_t a8);
 	void io_write(uint8_t a8, uint8_t d8);
@@ -48,23 +77,45 @@ public:
 	void oamram_write(uint8_t a8, uint8_t d8);
 
 public:
-	uint8_t picture[144][160];
+	// all tiles decoded to one byte per pixel, and the same mirrored;
+	// kept up to date by vram_write()
+	uint8_t tiles[384][8][8];
+	uint8_t tiles_flipped[384][8][8];
+
+	framebuffer frames;
     bool dirty;
+	ppu_stats_t stats;
+	// only available if built with PPU_TRACE: writes the entries,
+	// oldest first, as ppu_trace_entry_t; returns their number
+	size_t dump_trace(FILE *file);
+	void reset_trace();
+	// frames not drawn after each drawn one; -1: none are drawn
+	int frame_skip;
+	// false: draw every line with the pixel FIFO (if built with FAST_LINES)
+	bool fast_lines;
 
 private:
 	uint8_t *oamram;
 
+	uint64_t synced; // cycle the PPU has been run up to
 	bool clock_even;
 	int clock;
 	int oam_counter;
 	int oam_out_counter;
 	int oam_t;
 	bool oam_candidate;
+	bool oam_cached; // the whole search was done at the start of mode 2
 	int bg_t; // internal BG fetch state (0-3)
 	int bg_index_ctr; // offset of the current index within the line
 	int window;
 
-	pixel_t bg_pixel_queue[16];
+	// the 16 pixel queue as shift registers, front pixel in bit 15;
+	// the lower half is where the fetcher puts background/window pixels
+	uint16_t fifo_lo;      // bitplanes of the pixel value
+	uint16_t fifo_hi;
+	uint16_t fifo_obj;     // sprite pixel
+	uint16_t fifo_obj1;    // sprite pixel through OBP1
+	uint16_t fifo_invalid; // nothing fetched yet
 
 	bool screen_off;
 	bool vram_locked;
@@ -73,7 +124,8 @@ private:
 	int pixel_x;
 	int line;
 	uint8_t skip;
-	uint8_t *ppicture;
+	uint8_t line_buffer[160]; // source << 2 | shade
+	uint8_t *pline;
 
 	typedef enum {
 		mode_hblank = 0,
@@ -106,13 +158,26 @@ private:
 
 	int8_t active_sprite_index[10];
 	oamentry *cur_oam;
+	// slots of active_sprite_index by X, and the first one not passed yet
+	int8_t sprite_order[10];
+	int sprite_count;
+	int sprite_next;
 
+#ifdef PPU_DEBUG_STRINGS
 	char debug_string_pixel[1024];
 	char debug_string_fetch[1024];
 	void debug_init();
 	void debug_pixel(char);
 	void debug_fetch(char);
 	void debug_flush();
+#endif
+
+#ifdef PPU_TRACE
+	ppu_trace_entry_t trace[PPU_TRACE_SIZE];
+	uint64_t trace_count;
+	int mode3_start;
+	void trace_add(ppu_trace_type_t type, uint16_t data);
+#endif
 
 	void screen_reset();
 	int output_pixel(uint8_t p);
@@ -123,6 +188,7 @@ private:
 	uint8_t get_sprite_height();
 	void oam_reset();
 	void oam_step();
+	void oam_uncache();
 
 	void hblank_reset();
 	void hblank_step();
@@ -130,6 +196,7 @@ private:
 	void vblank_step();
 
 	void irq_step();
+	void schedule();
 
 	void line_reset();
 
@@ -137,6 +204,21 @@ private:
 	void pixel_reset();
 	void pixel_step();
 	void fetch_step();
+
+	// lines rendered by render_line() that haven't been drawn yet
+	uint8_t pending_lines[144];
+	int8_t pending_sprites[144][10];
+	int pending_count;
+	int frame_fifo_lines;
+	bool render; // whether this frame is drawn
+	int skipped;
+	int frame_flushes;
+
+	void decode_tile_row(uint16_t a16);
+	void decode_tiles();
+	void render_line(int y, const int8_t *sprites, uint8_t *out);
+	void flush_lines();
+	void frame_done();
 };
 
 #endif /* ppu_h */
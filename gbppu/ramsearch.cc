@@ -0,0 +1,320 @@
+//
+//  ramsearch.cc
+//  gbppu
+//
+
+#include <string.h>
+#include "ramsearch.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+ramsearch::ramsearch(type_t type)
+	: type(type)
+{
+	reset();
+}
+
+void ramsearch::
+reset()
+{
+	memset(candidate, 0xff, sizeof(candidate));
+	memset(candidate + RAMSEARCH_HRAM_OFFSET + 0x7f, 0, RAMSEARCH_EXTRAM_OFFSET - RAMSEARCH_HRAM_OFFSET - 0x7f);
+	if (type == type_u16 || type == type_bcd16) {
+		// values can't span two regions
+		candidate[RAMSEARCH_HRAM_OFFSET - 1] = 0;
+		candidate[RAMSEARCH_HRAM_OFFSET + 0x7f - 1] = 0;
+	}
+}
+
+#pragma mark - Scalar
+
+static inline bool
+decode_bcd(uint8_t d8, int &value)
+{
+	value = (d8 >> 4) * 10 + (d8 & 15);
+	return (d8 & 15) <= 9 && (d8 >> 4) <= 9;
+}
+
+static inline bool
+decode(const uint8_t *data, int index, ramsearch::type_t type, int &value)
+{
+	int lo, hi;
+	switch (type) {
+		default:
+		case ramsearch::type_u8:
+			value = data[index];
+			return true;
+		case ramsearch::type_u16:
+			value = data[index] | (data[index + 1] << 8);
+			return true;
+		case ramsearch::type_bcd8:
+			return decode_bcd(data[index], value);
+		case ramsearch::type_bcd16: {
+			bool valid = decode_bcd(data[index], lo) & decode_bcd(data[index + 1], hi);
+			value = hi * 100 + lo;
+			return valid;
+		}
+	}
+}
+
+static inline bool
+compare(int a, int b, ramsearch::compare_t cmp, int operand, ramsearch::type_t type)
+{
+	switch (cmp) {
+		default:
+		case ramsearch::cmp_equal:
+			return a == b;
+		case ramsearch::cmp_not_equal:
+			return a != b;
+		case ramsearch::cmp_greater:
+			return a > b;
+		case ramsearch::cmp_less:
+			return a < b;
+		case ramsearch::cmp_difference:
+			// binary values wrap around like the CPU's arithmetic does
+			switch (type) {
+				case ramsearch::type_u8:
+					return ((a - b) & 0xff) == (operand & 0xff);
+				case ramsearch::type_u16:
+					return ((a - b) & 0xffff) == (operand & 0xffff);
+				default:
+					return a - b == operand;
+			}
+	}
+}
+
+#pragma mark - SSE2
+
+#if defined(__SSE2__)
+// 16 unsigned bytes: a <cmp> b
+static inline __m128i
+compare8(__m128i a, __m128i b, ramsearch::compare_t cmp, __m128i operand)
+{
+	const __m128i ones = _mm_set1_epi8(-1);
+	switch (cmp) {
+		default:
+		case ramsearch::cmp_equal:
+			return _mm_cmpeq_epi8(a, b);
+		case ramsearch::cmp_not_equal:
+			return _mm_xor_si128(_mm_cmpeq_epi8(a, b), ones);
+		case ramsearch::cmp_greater:
+			return _mm_xor_si128(_mm_cmpeq_epi8(_mm_min_epu8(a, b), a), ones);
+		case ramsearch::cmp_less:
+			return _mm_xor_si128(_mm_cmpeq_epi8(_mm_max_epu8(a, b), a), ones);
+		case ramsearch::cmp_difference:
+			return _mm_cmpeq_epi8(_mm_sub_epi8(a, b), operand);
+	}
+}
+
+// 8 unsigned words: a <cmp> b
+static inline __m128i
+compare16(__m128i a, __m128i b, ramsearch::compare_t cmp, __m128i operand)
+{
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m128i sign = _mm_set1_epi16(-0x8000);
+	switch (cmp) {
+		default:
+		case ramsearch::cmp_equal:
+			return _mm_cmpeq_epi16(a, b);
+		case ramsearch::cmp_not_equal:
+			return _mm_xor_si128(_mm_cmpeq_epi16(a, b), ones);
+		case ramsearch::cmp_greater:
+			return _mm_cmpgt_epi16(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+		case ramsearch::cmp_less:
+			return _mm_cmpgt_epi16(_mm_xor_si128(b, sign), _mm_xor_si128(a, sign));
+		case ramsearch::cmp_difference:
+			return _mm_cmpeq_epi16(_mm_sub_epi16(a, b), operand);
+	}
+}
+
+// BCD to binary in place (x - 6 * high nibble); returns the validity mask
+static inline __m128i
+decode_bcd8(__m128i &x)
+{
+	const __m128i nibble = _mm_set1_epi8(15);
+	const __m128i nine = _mm_set1_epi8(9);
+	__m128i lo = _mm_and_si128(x, nibble);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+	__m128i hi2 = _mm_add_epi8(hi, hi);
+	x = _mm_sub_epi8(x, _mm_add_epi8(_mm_add_epi8(hi2, hi2), hi2));
+	return _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi8(lo, nine), _mm_cmpgt_epi8(hi, nine)), _mm_set1_epi8(-1));
+}
+
+// 8 little endian values starting at p, one per 16 bit lane
+static inline __m128i
+load16(const uint8_t *p, bool bcd, __m128i &valid)
+{
+	__m128i lo = _mm_loadl_epi64((const __m128i *)p);
+	__m128i hi = _mm_loadl_epi64((const __m128i *)(p + 1));
+	if (!bcd) {
+		valid = _mm_set1_epi8(-1);
+		return _mm_unpacklo_epi8(lo, hi);
+	}
+	valid = _mm_and_si128(decode_bcd8(lo), decode_bcd8(hi));
+	valid = _mm_unpacklo_epi8(valid, valid);
+	lo = _mm_unpacklo_epi8(lo, _mm_setzero_si128());
+	hi = _mm_unpacklo_epi8(hi, _mm_setzero_si128());
+	return _mm_add_epi16(lo, _mm_mullo_epi16(hi, _mm_set1_epi16(100)));
+}
+#endif
+
+#pragma mark - Filter
+
+void ramsearch::
+filter_internal(const ram_snapshot_t &a, const ram_snapshot_t *b, int value, compare_t cmp, int operand)
+{
+	int limit = type == type_bcd8 ? 99 : type == type_bcd16 ? 9999 : 0xffff;
+	if (cmp == cmp_difference && (operand > limit || operand < -limit)) {
+		memset(candidate, 0, sizeof(candidate));
+		return;
+	}
+
+	const uint8_t *pa = a.data;
+	const uint8_t *pb = b ? b->data : 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	if (type == type_u8 || type == type_bcd8) {
+		bool bcd = type == type_bcd8;
+		__m128i vop = _mm_set1_epi8((char)operand);
+		__m128i vb = _mm_set1_epi8((char)value);
+		__m128i valid_b = _mm_set1_epi8(-1);
+		for (; i < RAMSEARCH_SIZE; i += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(pa + i));
+			__m128i valid = _mm_set1_epi8(-1);
+			if (pb) {
+				vb = _mm_loadu_si128((const __m128i *)(pb + i));
+				if (bcd) {
+					valid_b = decode_bcd8(vb);
+				}
+			}
+			if (bcd) {
+				valid = _mm_and_si128(decode_bcd8(va), valid_b);
+			}
+			__m128i m = _mm_and_si128(compare8(va, vb, cmp, vop), valid);
+			__m128i *c = (__m128i *)(candidate + i);
+			_mm_storeu_si128(c, _mm_and_si128(_mm_loadu_si128(c), m));
+		}
+	} else {
+		bool bcd = type == type_bcd16;
+		__m128i vop = _mm_set1_epi16((short)operand);
+		__m128i vb = _mm_set1_epi16((short)value);
+		__m128i valid_b = _mm_set1_epi8(-1);
+		for (; i < RAMSEARCH_SIZE; i += 8) {
+			__m128i valid;
+			__m128i va = load16(pa + i, bcd, valid);
+			if (pb) {
+				vb = load16(pb + i, bcd, valid_b);
+			}
+			__m128i m = _mm_and_si128(compare16(va, vb, cmp, vop), _mm_and_si128(valid, valid_b));
+			m = _mm_packs_epi16(m, m);
+			__m128i *c = (__m128i *)(candidate + i);
+			_mm_storel_epi64(c, _mm_and_si128(_mm_loadl_epi64(c), m));
+		}
+	}
+#endif
+
+	for (; i < RAMSEARCH_SIZE; i++) {
+		if (!candidate[i]) {
+			continue;
+		}
+		int va, vb = value;
+		bool valid = decode(pa, i, type, va);
+		if (pb) {
+			valid &= decode(pb, i, type, vb);
+		}
+		if (!valid || !compare(va, vb, cmp, operand, type)) {
+			candidate[i] = 0;
+		}
+	}
+
+	// cartridge RAM beyond what the cartridge has
+	int end = RAMSEARCH_EXTRAM_OFFSET + a.extramsize;
+	if (end > RAMSEARCH_EXTRAM_OFFSET && (type == type_u16 || type == type_bcd16)) {
+		end--;
+	}
+	memset(candidate + end, 0, RAMSEARCH_SIZE - end);
+}
+
+void ramsearch::
+filter(const ram_snapshot_t &cur, const ram_snapshot_t &prev, compare_t cmp, int operand)
+{
+	filter_internal(cur, &prev, 0, cmp, operand);
+}
+
+void ramsearch::
+filter_series(const ram_snapshot_t *snapshots, size_t count, compare_t cmp, int operand)
+{
+	for (size_t i = 1; i < count; i++) {
+		filter_internal(snapshots[i], &snapshots[i - 1], 0, cmp, operand);
+	}
+}
+
+bool ramsearch::
+filter_value(const ram_snapshot_t &cur, compare_t cmp, int value)
+{
+	// checked once here, because the SSE2 code would truncate the value
+	// and the scalar code wouldn't
+	int max = type == type_u8 ? 0xff : type == type_bcd8 ? 99 : type == type_bcd16 ? 9999 : 0xffff;
+	if (value < 0 || value > max) {
+		return false;
+	}
+	filter_internal(cur, 0, value, cmp, 0);
+	return true;
+}
+
+#pragma mark - Results
+
+int ramsearch::
+count()
+{
+	int n = 0;
+	int i = 0;
+#if defined(__SSE2__)
+	__m128i sum = _mm_setzero_si128();
+	for (; i < RAMSEARCH_SIZE; i += 16) {
+		__m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *)(candidate + i)), _mm_set1_epi8(1));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(c, _mm_setzero_si128()));
+	}
+	n = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#endif
+	for (; i < RAMSEARCH_SIZE; i++) {
+		n += !!candidate[i];
+	}
+	return n;
+}
+
+int ramsearch::
+get_candidates(int *index, int max)
+{
+	int n = 0;
+	for (int i = 0; i < RAMSEARCH_SIZE && n < max; i++) {
+		if (candidate[i]) {
+			index[n++] = i;
+		}
+	}
+	return n;
+}
+
+uint32_t ramsearch::
+address_for_index(int index)
+{
+	if (index < RAMSEARCH_HRAM_OFFSET) {
+		return 0xc000 + index;
+	} else if (index < RAMSEARCH_EXTRAM_OFFSET) {
+		return 0xff80 + index - RAMSEARCH_HRAM_OFFSET;
+	} else {
+		index -= RAMSEARCH_EXTRAM_OFFSET;
+		return ((index >> 13) << 16) | (0xa000 + (index & 0x1fff));
+	}
+}
+
+int ramsearch::
+value_at(const ram_snapshot_t &snapshot, int index, type_t type)
+{
+	int value;
+	decode(snapshot.data, index, type, value);
+	return value;
+}
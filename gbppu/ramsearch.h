@@ -0,0 +1,67 @@
+//
+//  ramsearch.h
+//  gbppu
+//
+
+#ifndef ramsearch_h
+#define ramsearch_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAMSEARCH_WRAM_OFFSET   0x0000 /* 0xC000 - 0xDFFF */
+#define RAMSEARCH_HRAM_OFFSET   0x2000 /* 0xFF80 - 0xFFFE */
+#define RAMSEARCH_EXTRAM_OFFSET 0x2080 /* 0xA000 - 0xBFFF, all banks */
+#define RAMSEARCH_SIZE          0xA080
+
+// all RAM the CPU can see, in one flat array
+typedef struct ram_snapshot {
+	uint8_t data[RAMSEARCH_SIZE + 16]; // padded for SIMD loads
+	uint16_t extramsize;
+} ram_snapshot_t;
+
+class ramsearch {
+public:
+	typedef enum {
+		type_u8,
+		type_u16,   // little endian
+		type_bcd8,  // 2 digits
+		type_bcd16, // 4 digits, little endian
+	} type_t;
+
+	typedef enum {
+		cmp_equal,
+		cmp_not_equal,
+		cmp_greater,
+		cmp_less,
+		cmp_difference, // a - b == operand
+	} compare_t;
+
+private:
+	type_t type;
+	uint8_t candidate[RAMSEARCH_SIZE];
+
+	void filter_internal(const ram_snapshot_t &a, const ram_snapshot_t *b, int value, compare_t cmp, int operand);
+
+public:
+	ramsearch(type_t type);
+
+	void reset();
+
+	// keep addresses for which cur <cmp> prev holds
+	void filter(const ram_snapshot_t &cur, const ram_snapshot_t &prev, compare_t cmp, int operand = 0);
+	// same for every consecutive pair of a series of snapshots
+	void filter_series(const ram_snapshot_t *snapshots, size_t count, compare_t cmp, int operand = 0);
+	// keep addresses for which cur <cmp> value holds; false, and no
+	// change, if the type can't hold the value
+	bool filter_value(const ram_snapshot_t &cur, compare_t cmp, int value);
+
+	int count();
+	int get_candidates(int *index, int max);
+
+	// (bank << 16) | address for a snapshot index
+	static uint32_t address_for_index(int index);
+	static int value_at(const ram_snapshot_t &snapshot, int index, type_t type);
+};
+
+#endif /* ramsearch_h */
@@ -0,0 +1,250 @@
+//
+//  scale.cc
+//  gbppu
+//
+
+#include <string.h>
+#include "scale.h"
+#include "framebuffer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define W FRAMEBUFFER_WIDTH
+#define H FRAMEBUFFER_HEIGHT
+
+// a row with its edge pixels repeated on both sides, at row + 1, and
+// room for 16 byte loads
+#define ROW_SIZE (W + 32)
+
+static inline uint32_t *
+out_row(uint32_t *out, size_t out_pitch, int y)
+{
+	return (uint32_t *)((uint8_t *)out + y * out_pitch);
+}
+
+static void
+load_row(const uint8_t *picture, size_t pitch, int y, uint8_t *row)
+{
+	y = y < 0 ? 0 : y >= H ? H - 1 : y;
+	memcpy(row + 1, picture + y * pitch, W);
+	row[0] = row[1];
+	row[W + 1] = row[W];
+}
+
+static inline void
+map_row(const uint8_t *index, int count, const uint32_t colors[256], uint32_t *out)
+{
+	for (int i = 0; i < count; i++) {
+		out[i] = colors[index[i]];
+	}
+}
+
+#pragma mark - Nearest
+
+void
+scale_nearest(const uint8_t *picture, size_t pitch, int factor, const uint32_t colors[256], const uint32_t *grid_colors, uint32_t *out, size_t out_pitch)
+{
+	if (factor < 1 || factor > SCALE_MAX_FACTOR) {
+		return;
+	}
+
+	for (int y = 0; y < H; y++) {
+		const uint8_t *src = picture + y * pitch;
+		for (int pass = 0; pass < 2; pass++) {
+			// the inside of the blocks, then the grid row
+			const uint32_t *c = pass ? grid_colors : colors;
+			uint32_t *dst = out_row(out, out_pitch, y * factor + (pass ? factor - 1 : 0));
+			if (pass && (!grid_colors || factor == 1)) {
+				break;
+			}
+			int x = 0;
+#if defined(__SSE2__)
+			// 4 copies per store; a block of less than 4 is finished
+			// by the next one, so the end of the row is done below
+			for (; x * factor + 4 <= W * factor; x++) {
+				__m128i v = _mm_set1_epi32(c[src[x]]);
+				uint32_t *d = dst + x * factor;
+				_mm_storeu_si128((__m128i *)d, v);
+				if (factor > 4) {
+					_mm_storeu_si128((__m128i *)(d + factor - 4), v);
+				}
+			}
+#endif
+			for (; x < W; x++) {
+				for (int i = 0; i < factor; i++) {
+					dst[x * factor + i] = c[src[x]];
+				}
+			}
+			if (grid_colors && factor > 1) {
+				for (x = 0; x < W; x++) {
+					dst[x * factor + factor - 1] = grid_colors[src[x]];
+				}
+			}
+		}
+
+		const uint32_t *first = out_row(out, out_pitch, y * factor);
+		int rows = grid_colors && factor > 1 ? factor - 1 : factor;
+		for (int i = 1; i < rows; i++) {
+			memcpy(out_row(out, out_pitch, y * factor + i), first, W * factor * sizeof(uint32_t));
+		}
+	}
+}
+
+#pragma mark - Scale2x
+
+// B above, D left, F right, H below E
+static void
+scale2x_row(const uint8_t *up, const uint8_t *cur, const uint8_t *down, uint8_t *top, uint8_t *bottom)
+{
+	int x = 0;
+#if defined(__SSE2__)
+	const __m128i ones = _mm_set1_epi8(-1);
+	static_assert(W % 16 == 0, "no tail");
+	for (; x < W; x += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(up + 1 + x));
+		__m128i d = _mm_loadu_si128((const __m128i *)(cur + x));
+		__m128i e = _mm_loadu_si128((const __m128i *)(cur + 1 + x));
+		__m128i f = _mm_loadu_si128((const __m128i *)(cur + 2 + x));
+		__m128i h = _mm_loadu_si128((const __m128i *)(down + 1 + x));
+		// B != H && D != F: there is an edge to smooth
+		__m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(b, h), _mm_cmpeq_epi8(d, f)), ones);
+		__m128i m0 = _mm_and_si128(edge, _mm_cmpeq_epi8(d, b));
+		__m128i m1 = _mm_and_si128(edge, _mm_cmpeq_epi8(b, f));
+		__m128i m2 = _mm_and_si128(edge, _mm_cmpeq_epi8(d, h));
+		__m128i m3 = _mm_and_si128(edge, _mm_cmpeq_epi8(h, f));
+		__m128i e0 = _mm_or_si128(_mm_and_si128(m0, d), _mm_andnot_si128(m0, e));
+		__m128i e1 = _mm_or_si128(_mm_and_si128(m1, f), _mm_andnot_si128(m1, e));
+		__m128i e2 = _mm_or_si128(_mm_and_si128(m2, d), _mm_andnot_si128(m2, e));
+		__m128i e3 = _mm_or_si128(_mm_and_si128(m3, f), _mm_andnot_si128(m3, e));
+		_mm_storeu_si128((__m128i *)(top + 2 * x), _mm_unpacklo_epi8(e0, e1));
+		_mm_storeu_si128((__m128i *)(top + 2 * x + 16), _mm_unpackhi_epi8(e0, e1));
+		_mm_storeu_si128((__m128i *)(bottom + 2 * x), _mm_unpacklo_epi8(e2, e3));
+		_mm_storeu_si128((__m128i *)(bottom + 2 * x + 16), _mm_unpackhi_epi8(e2, e3));
+	}
+#else
+	for (; x < W; x++) {
+		uint8_t b = up[x + 1], d = cur[x], e = cur[x + 1], f = cur[x + 2], h = down[x + 1];
+		bool edge = b != h && d != f;
+		top[2 * x]        = edge && d == b ? d : e;
+		top[2 * x + 1]    = edge && b == f ? f : e;
+		bottom[2 * x]     = edge && d == h ? d : e;
+		bottom[2 * x + 1] = edge && h == f ? f : e;
+	}
+#endif
+}
+
+void
+scale_scale2x(const uint8_t *picture, size_t pitch, const uint32_t colors[256], uint32_t *out, size_t out_pitch)
+{
+	uint8_t rows[3][ROW_SIZE];
+	uint8_t result[2][W * 2];
+
+	load_row(picture, pitch, -1, rows[0]);
+	load_row(picture, pitch, 0, rows[1]);
+	for (int y = 0; y < H; y++) {
+		load_row(picture, pitch, y + 1, rows[(y + 2) % 3]);
+		scale2x_row(rows[y % 3], rows[(y + 1) % 3], rows[(y + 2) % 3], result[0], result[1]);
+		map_row(result[0], W * 2, colors, out_row(out, out_pitch, 2 * y));
+		map_row(result[1], W * 2, colors, out_row(out, out_pitch, 2 * y + 1));
+	}
+}
+
+#pragma mark - Scale3x
+
+//  A B C
+//  D E F
+//  G H I
+static void
+scale3x_row(const uint8_t *up, const uint8_t *cur, const uint8_t *down, uint8_t *out0, uint8_t *out1, uint8_t *out2)
+{
+	int x = 0;
+#if defined(__SSE2__)
+	const __m128i ones = _mm_set1_epi8(-1);
+#define EQ(p, q) _mm_cmpeq_epi8(p, q)
+#define NE(p, q) _mm_andnot_si128(_mm_cmpeq_epi8(p, q), ones)
+#define AND(p, q) _mm_and_si128(p, q)
+#define SEL(m, p, q) _mm_or_si128(_mm_and_si128(m, p), _mm_andnot_si128(m, q))
+	for (; x + 16 <= W; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(up + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(up + 1 + x));
+		__m128i c = _mm_loadu_si128((const __m128i *)(up + 2 + x));
+		__m128i d = _mm_loadu_si128((const __m128i *)(cur + x));
+		__m128i e = _mm_loadu_si128((const __m128i *)(cur + 1 + x));
+		__m128i f = _mm_loadu_si128((const __m128i *)(cur + 2 + x));
+		__m128i g = _mm_loadu_si128((const __m128i *)(down + x));
+		__m128i h = _mm_loadu_si128((const __m128i *)(down + 1 + x));
+		__m128i i = _mm_loadu_si128((const __m128i *)(down + 2 + x));
+		__m128i edge = AND(NE(b, h), NE(d, f));
+		__m128i db = AND(edge, EQ(d, b));
+		__m128i bf = AND(edge, EQ(b, f));
+		__m128i dh = AND(edge, EQ(d, h));
+		__m128i hf = AND(edge, EQ(h, f));
+		__m128i e0 = SEL(db, d, e);
+		__m128i e1 = SEL(_mm_or_si128(AND(db, NE(e, c)), AND(bf, NE(e, a))), b, e);
+		__m128i e2 = SEL(bf, f, e);
+		__m128i e3 = SEL(_mm_or_si128(AND(db, NE(e, g)), AND(dh, NE(e, a))), d, e);
+		__m128i e5 = SEL(_mm_or_si128(AND(bf, NE(e, i)), AND(hf, NE(e, c))), f, e);
+		__m128i e6 = SEL(dh, d, e);
+		__m128i e7 = SEL(_mm_or_si128(AND(dh, NE(e, i)), AND(hf, NE(e, g))), h, e);
+		__m128i e8 = SEL(hf, f, e);
+		uint8_t t[9][16];
+		_mm_storeu_si128((__m128i *)t[0], e0);
+		_mm_storeu_si128((__m128i *)t[1], e1);
+		_mm_storeu_si128((__m128i *)t[2], e2);
+		_mm_storeu_si128((__m128i *)t[3], e3);
+		_mm_storeu_si128((__m128i *)t[4], e);
+		_mm_storeu_si128((__m128i *)t[5], e5);
+		_mm_storeu_si128((__m128i *)t[6], e6);
+		_mm_storeu_si128((__m128i *)t[7], e7);
+		_mm_storeu_si128((__m128i *)t[8], e8);
+		// no 3-way byte interleave in SSE2
+		for (int j = 0; j < 16; j++) {
+			uint8_t *o0 = out0 + 3 * (x + j), *o1 = out1 + 3 * (x + j), *o2 = out2 + 3 * (x + j);
+			o0[0] = t[0][j]; o0[1] = t[1][j]; o0[2] = t[2][j];
+			o1[0] = t[3][j]; o1[1] = t[4][j]; o1[2] = t[5][j];
+			o2[0] = t[6][j]; o2[1] = t[7][j]; o2[2] = t[8][j];
+		}
+	}
+#undef EQ
+#undef NE
+#undef AND
+#undef SEL
+#else
+	for (; x < W; x++) {
+		uint8_t a = up[x], b = up[x + 1], c = up[x + 2];
+		uint8_t d = cur[x], e = cur[x + 1], f = cur[x + 2];
+		uint8_t g = down[x], h = down[x + 1], i = down[x + 2];
+		bool edge = b != h && d != f;
+		bool db = edge && d == b, bf = edge && b == f, dh = edge && d == h, hf = edge && h == f;
+		uint8_t *o0 = out0 + 3 * x, *o1 = out1 + 3 * x, *o2 = out2 + 3 * x;
+		o0[0] = db ? d : e;
+		o0[1] = (db && e != c) || (bf && e != a) ? b : e;
+		o0[2] = bf ? f : e;
+		o1[0] = (db && e != g) || (dh && e != a) ? d : e;
+		o1[1] = e;
+		o1[2] = (bf && e != i) || (hf && e != c) ? f : e;
+		o2[0] = dh ? d : e;
+		o2[1] = (dh && e != i) || (hf && e != g) ? h : e;
+		o2[2] = hf ? f : e;
+	}
+#endif
+}
+
+void
+scale_scale3x(const uint8_t *picture, size_t pitch, const uint32_t colors[256], uint32_t *out, size_t out_pitch)
+{
+	uint8_t rows[3][ROW_SIZE];
+	uint8_t result[3][W * 3];
+
+	load_row(picture, pitch, -1, rows[0]);
+	load_row(picture, pitch, 0, rows[1]);
+	for (int y = 0; y < H; y++) {
+		load_row(picture, pitch, y + 1, rows[(y + 2) % 3]);
+		scale3x_row(rows[y % 3], rows[(y + 1) % 3], rows[(y + 2) % 3], result[0], result[1], result[2]);
+		for (int i = 0; i < 3; i++) {
+			map_row(result[i], W * 3, colors, out_row(out, out_pitch, 3 * y + i));
+		}
+	}
+}
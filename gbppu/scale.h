@@ -0,0 +1,27 @@
+//
+//  scale.h
+//  gbppu
+//
+
+#ifndef scale_h
+#define scale_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCALE_MAX_FACTOR 8
+
+// Upscalers for frames with one byte per pixel (pixel_shade or
+// pixel_indexed8, 160x144 at any pitch). They write 32 bit pixels from
+// a table, so the caller picks the byte order; out_pitch is in bytes.
+
+// every pixel becomes a factor x factor block (1-8); with grid_colors,
+// the last row and column of each block use those, like the gaps
+// between the pixels of an LCD
+void scale_nearest(const uint8_t *picture, size_t pitch, int factor, const uint32_t colors[256], const uint32_t *grid_colors, uint32_t *out, size_t out_pitch);
+
+// Scale2x/Scale3x: 2x and 3x with diagonal edges smoothed
+void scale_scale2x(const uint8_t *picture, size_t pitch, const uint32_t colors[256], uint32_t *out, size_t out_pitch);
+void scale_scale3x(const uint8_t *picture, size_t pitch, const uint32_t colors[256], uint32_t *out, size_t out_pitch);
+
+#endif /* scale_h */
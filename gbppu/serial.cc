@@ -6,31 +6,207 @@
 //  Copyright © 2016 Michael Steil. All rights reserved.
 //
 
-#include <assert.h>
+#include <string.h>
 #include "serial.h"
+#include "linkcable.h"
 #include "io.h"
 
+#define SERIAL_TRANSFER_CYCLES (8 * 512) /* 8 bits at 8192 Hz */
+
 serial::serial(io &io)
-	: _io(io)
+	: _io         (io)
+	, transfer_end(EVENT_NEVER)
+	, _link       (0)
+	, _port       (0)
+	, link_base   (0)
+	, capture_length(0)
+	, num_triggers(0)
+	, triggered   (-1)
+{
+}
+
+// the peer would otherwise wait for us forever
+serial::~serial()
 {
+	if (_link) {
+		_link->disconnect(_port);
+	}
+}
+
+void serial::
+connect(linkcable *link, int port)
+{
+	if (_link) {
+		_link->disconnect(_port);
+	}
+	_link = link;
+	_port = port;
+	link_base = _io.cycle;
+	if (_link) {
+		_link->connect(_port);
+	}
+	schedule();
 }
 
 uint8_t serial::
 read(uint8_t a8)
 {
-//	printf("warning: serial read %s (0xff%02x) -> 0x%02x\n", name_for_io_reg(a8), a8, _io.reg[a8]);
 	switch (a8) {
-		case rSB:
-			return 0x00;
 		case rSC:
-			return 0x7e;
+			return _io.reg[a8] | 0x7e;
+		default:
+			return _io.reg[a8];
 	}
-	assert(0);
 }
 
 void serial::
 write(uint8_t a8, uint8_t d8)
 {
 	_io.reg[a8] = d8;
-//	printf("warning: serial I/O write %s 0xff%02x <- 0x%02x\n", name_for_io_reg(a8), a8, d8);
+
+	if (a8 == rSC && (d8 & 0x80)) {
+		capture_byte(_io.reg[rSB]);
+	}
+
+	if (a8 == rSC && (d8 & 0x81) == 0x81) {
+		// start a transfer on the internal clock; on the external
+		// clock, we wait for the peer to start one
+		transfer_end = _io.cycle + SERIAL_TRANSFER_CYCLES;
+		if (_link) {
+			_link->start_transfer(_port, transfer_end - link_base, _io.reg[rSB]);
+		}
+		schedule();
+	}
+}
+
+#pragma mark - Capture
+
+void serial::
+capture_byte(uint8_t d8)
+{
+	if (capture_length == SERIAL_CAPTURE_SIZE) {
+		// keep the most recent half
+		memmove(capture, capture + SERIAL_CAPTURE_SIZE / 2, SERIAL_CAPTURE_SIZE / 2);
+		capture_length = SERIAL_CAPTURE_SIZE / 2;
+	}
+	capture[capture_length++] = d8;
+
+	for (int i = 0; i < num_triggers; i++) {
+		trigger_t *t = &triggers[i];
+		if (capture_length >= t->length && !memcmp(capture + capture_length - t->length, t->pattern, t->length)) {
+			triggered = i;
+			break;
+		}
+	}
+}
+
+const uint8_t *serial::
+get_capture(size_t &length) const
+{
+	length = capture_length;
+	return capture;
+}
+
+void serial::
+clear_capture()
+{
+	capture_length = 0;
+	triggered = -1;
+}
+
+int serial::
+add_trigger(const uint8_t *pattern, size_t length)
+{
+	if (num_triggers == SERIAL_MAX_TRIGGERS || !length || length > SERIAL_MAX_TRIGGER_LENGTH) {
+		return -1;
+	}
+	memcpy(triggers[num_triggers].pattern, pattern, length);
+	triggers[num_triggers].length = length;
+	return num_triggers++;
+}
+
+#pragma mark - Transfers
+
+// A transfer of the peer has ended, so we receive a byte if we are
+// waiting for one, and send ours back.
+void serial::
+answer_incoming()
+{
+	uint64_t end;
+	uint8_t in;
+	if (!_link->incoming_transfer(_port, _io.cycle - link_base, end, in)) {
+		return;
+	}
+
+	uint8_t reply = 0xff;
+	if ((_io.reg[rSC] & 0x81) == 0x80) {
+		reply = _io.reg[rSB];
+		_io.reg[rSB] = in;
+		_io.reg[rSC] &= 0x7f;
+		_io.irq_set_pending(3);
+	}
+	_link->answer_transfer(_port, end, reply);
+}
+
+// Blocks while we are too far ahead of the peer.
+void serial::
+wait_for_peer()
+{
+	uint64_t now = _io.cycle - link_base;
+	for (int tries = 0;; tries++) {
+		_link->publish(_port, now);
+		answer_incoming();
+		// our own changes are older than this
+		uint64_t seen = _link->get_version();
+		if (now < _link->horizon(_port)) {
+			break;
+		}
+		_link->wait(tries, seen);
+	}
+}
+
+void serial::
+sync()
+{
+	if (_link) {
+		wait_for_peer();
+	}
+
+	if (transfer_end <= _io.cycle) {
+		uint8_t in = 0xff; // nothing connected
+		if (_link) {
+			for (int tries = 0;; tries++) {
+				wait_for_peer();
+				uint64_t seen = _link->get_version();
+				if (_link->finish_transfer(_port, in)) {
+					break;
+				}
+				_link->wait(tries, seen);
+			}
+		}
+		transfer_end = EVENT_NEVER;
+		_io.reg[rSB] = in;
+		_io.reg[rSC] &= 0x7f;
+		_io.irq_set_pending(3);
+	}
+
+	schedule();
+}
+
+void serial::
+schedule()
+{
+	uint64_t next = transfer_end;
+	if (_link) {
+		// also keep the peer informed how far we are
+		uint64_t horizon = _link->horizon(_port);
+		uint64_t publish = _io.cycle + LINKCABLE_LOOKAHEAD / 2;
+		if (horizon != UINT64_MAX && horizon + link_base < next) {
+			next = horizon + link_base;
+		}
+		if (publish < next) {
+			next = publish;
+		}
+	}
+	_io.schedule(event_serial, next);
 }
@@ -9,21 +9,61 @@
 #ifndef serial_h
 #define serial_h
 
+#include <stdint.h>
 #include <stdio.h>
 
+#define SERIAL_CAPTURE_SIZE 4096
+#define SERIAL_MAX_TRIGGERS 8
+#define SERIAL_MAX_TRIGGER_LENGTH 32
+
 class io;
+class linkcable;
 
 class serial {
 private:
 	io &_io;
 
+	uint64_t transfer_end; // of a transfer on the internal clock
+
+	linkcable *_link;
+	int _port;
+	uint64_t link_base; // cycle at which the cable was connected
+
+	// every byte sent, so test ROMs can report results
+	uint8_t capture[SERIAL_CAPTURE_SIZE];
+	size_t capture_length;
+
+	typedef struct {
+		uint8_t pattern[SERIAL_MAX_TRIGGER_LENGTH];
+		size_t length;
+	} trigger_t;
+	trigger_t triggers[SERIAL_MAX_TRIGGERS];
+	int num_triggers;
+
+	void capture_byte(uint8_t d8);
+
+	void answer_incoming();
+	void wait_for_peer();
+	void schedule();
+
 protected:
 	friend class gb;
 	serial(io &io);
+	~serial();
 
 public:
 	uint8_t read(uint8_t a8);
 	void write(uint8_t a8, uint8_t d8);
+	void sync();
+
+	void connect(linkcable *link, int port);
+
+	const uint8_t *get_capture(size_t &length) const;
+	void clear_capture();
+	// returns the trigger's number, or -1 if there is no more room
+	int add_trigger(const uint8_t *pattern, size_t length);
+	// the trigger that matched the end of the output, or -1
+	int triggered;
 };
 
 #endif /* serial_h */
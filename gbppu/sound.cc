@@ -9,9 +9,13 @@
 #include "sound.h"
 #include "io.h"
 
+#define SOUND_BATCH_CYCLES 70224 /* one frame */
+
 sound::sound(io &io)
 	: _io(io)
 {
+	clock_divider = 0;
+	synced = 0;
 	pulse_freq[0] = 0;
 	pulse_freq[1] = 0;
 	pulse_freq_counter[0] = 0;
@@ -19,6 +23,7 @@ sound::sound(io &io)
 	pulse_value[0] = false;
 	pulse_value[1] = false;
 	consumeSoundInteger = NULL;
+	hashing = false;
 
 	noise_random = 0xEA31;
 }
@@ -96,7 +101,7 @@ write(uint8_t a8, uint8_t d8)
 //			printf("%s:%d %x -> %d\n", __FILE__, __LINE__, _io.reg[rNR43], noise_freq);
 			noise_value = 0;
 			length[3] = (d8 & 0x40) ? ((_io.reg[rNR42] & 63) ^ 63) << 10 : 0;
-			printf("%s:%d %d\n", __FILE__, __LINE__, length[3]);
+			LOG(_io, log_sound, log_debug, "noise length %d", length[3]);
 			noise_restart();
 		} else {
 			noise_on = false;
@@ -104,15 +109,35 @@ write(uint8_t a8, uint8_t d8)
 	}
 }
 
-// runs at 131072 Hz
+// Catches up with the CPU. Samples are generated in batches, before a
+// register write can change the output, and at the latest once a frame.
 void sound::
-step()
+sync()
 {
-	clock_divider = (clock_divider + 1) & 15;
-	if (clock_divider) {
-		return;
+	uint64_t cycles = clock_divider + _io.cycle - synced;
+	synced = _io.cycle;
+
+	clock_divider = cycles & 15;
+	for (cycles >>= 4; cycles; cycles--) {
+		step();
 	}
 
+	_io.schedule(event_sound, synced + SOUND_BATCH_CYCLES);
+}
+
+uint64_t sound::
+take_hash()
+{
+	sync();
+	uint64_t h = sample_hash.digest();
+	sample_hash.reset();
+	return h;
+}
+
+// runs at 131072 Hz
+void sound::
+step()
+{
 	// Pulse
 	for (int c = 0; c <= 1; c++) {
 		if (pulse_on[c]) {
@@ -162,6 +187,10 @@ step()
 //	uint16_t mixed_value = (wave_value * 512);
 	uint16_t mixed_value = noise_value ? 8192 : 0;
 
+	if (hashing) {
+		uint8_t le[2] = { (uint8_t)mixed_value, (uint8_t)(mixed_value >> 8) };
+		sample_hash.update(le, 2);
+	}
 	if (this->consumeSoundInteger) {
 		// stereo sample
 		(*this->consumeSoundInteger)(mixed_value);
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include "hash64.h"
 
 class io;
 
@@ -18,6 +19,7 @@ class sound {
 private:
 	io &_io;
 	int clock_divider;
+	uint64_t synced; // cycle the sound unit has been run up to
 
 	uint16_t length[4];
 
@@ -40,18 +42,24 @@ private:
 	uint16_t noise_random;
 	uint8_t noise_value;
 
+	bool hashing;
+	hash64 sample_hash;
+
 	void pulse_restart(int c);
 	void wave_restart();
 	void noise_restart();
+	void step();
 
 protected:
 	friend class gb;
 	sound(io &io);
+	// of the samples generated since the last call
+	uint64_t take_hash();
 
 public:
 	uint8_t read(uint8_t a8);
 	void write(uint8_t a8, uint8_t d8);
-	void step();
+	void sync();
     void (* consumeSoundInteger)(int16_t);
 };
 
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+#
+#  midframe.py
+#  gbppu
+#
+#  Writes midframe.gb, a 32 KB ROM that accesses PPU registers in mode 3
+#  of a few lines every frame, from an LYC interrupt handler. Everything
+#  else in these frames can be drawn by the fast line renderer, so
+#  together with cppmain -F it checks that both renderers mix:
+#
+#    python3 tests/midframe.py tests/midframe.gb
+#    cppmain -F -q -n 600 DMG_ROM.bin tests/midframe.gb
+#
+
+import sys
+
+# LY, register read, register written, value; accesses of 0x81 (HRAM)
+# only take the same time
+SCENARIO = [
+	(40,  0x81, 0x47, 0x1b), # BGP
+	(60,  0x41, 0x81, 0x00), # STAT read: only makes the FIFO draw the line
+	(80,  0x81, 0x43, 0x03), # SCX
+	(100, 0x41, 0x81, 0x00),
+	(110, 0x81, 0x47, 0xe4),
+	(120, 0x81, 0x43, 0x00),
+	(130, 0x41, 0x81, 0x00),
+]
+
+TABLE = 0x0200
+TILE = 0x0280
+HANDLER = 0x01c0
+
+rom = bytearray(0x8000)
+
+used = bytearray(0x8000)
+
+def put(address, code):
+	assert not any(used[address:address + len(code)]), "overlap at %04x" % address
+	rom[address:address + len(code)] = bytes(code)
+	used[address:address + len(code)] = b"\x01" * len(code)
+
+# STAT interrupt
+put(0x0048, [0xc3, HANDLER & 0xff, HANDLER >> 8])         # jp handler
+
+put(0x0100, [0x00, 0xc3, 0x50, 0x01])                     # nop; jp $0150
+# the boot ROM only starts cartridges with this logo
+put(0x0104, bytes.fromhex(
+	"ceed6666cc0d000b03730083000c000d0008111f8889000e"
+	"dccc6ee6ddddd999bbbb67636e0eecccdddc999fbbb9333e"))
+put(0x0134, b"MIDFRAME")
+
+main = [
+	0xf3,                   # di
+	0x31, 0xfe, 0xff,       # ld sp, $fffe
+	0xf0, 0x44,             # .vbl: ldh a, [LY]
+	0xfe, 144,              # cp 144
+	0x20, 0xfa,             # jr nz, .vbl
+	0xaf,                   # xor a
+	0xe0, 0x40,             # ldh [LCDC], a
+	0x21, 0x00, 0x80,       # ld hl, $8000 (tile 0)
+	0x11, TILE & 0xff, TILE >> 8, # ld de, tile
+	0x06, 16,               # ld b, 16
+	0x1a,                   # .copy: ld a, [de]
+	0x13,                   # inc de
+	0x22,                   # ld [hl+], a
+	0x05,                   # dec b
+	0x20, 0xfa,             # jr nz, .copy
+	0x3e, 0xe4,             # ld a, $e4
+	0xe0, 0x47,             # ldh [BGP], a
+	0xaf,                   # xor a
+	0xe0, 0x42,             # ldh [SCY], a
+	0xe0, 0x43,             # ldh [SCX], a
+	0xe0, 0x80,             # ldh [$80], a (table offset)
+	0x3e, SCENARIO[0][0],   # ld a, first LY
+	0xe0, 0x45,             # ldh [LYC], a
+	0x3e, 0x40,             # ld a, LYC interrupt
+	0xe0, 0x41,             # ldh [STAT], a
+	0x3e, 0x02,             # ld a, STAT interrupt
+	0xe0, 0xff,             # ldh [IE], a
+	0xaf,                   # xor a
+	0xe0, 0x0f,             # ldh [IF], a
+	0x3e, 0x91,             # ld a, LCD on, BG on, tiles at $8000
+	0xe0, 0x40,             # ldh [LCDC], a
+	0xfb,                   # ei
+	0x18, 0xfe,             # jr @
+]
+put(0x0150, main)
+
+# runs in mode 2; the access lands about 100 dots later, in mode 3
+handler = [
+	0xf5,                   # push af
+	0xe5,                   # push hl
+	0xc5,                   # push bc
+	0xf0, 0x80,             # ldh a, [$80]
+	0x6f,                   # ld l, a
+	0x26, TABLE >> 8,       # ld h, table
+	0x2a,                   # ld a, [hl+]
+	0x4f,                   # ld c, a
+	0xf2,                   # ldh a, [c]
+	0x2a,                   # ld a, [hl+]
+	0x4f,                   # ld c, a
+	0x2a,                   # ld a, [hl+]
+	0xe2,                   # ldh [c], a
+	0x2a,                   # ld a, [hl+] (next LY)
+	0xe0, 0x45,             # ldh [LYC], a
+	0x7d,                   # ld a, l
+	0xfe, len(SCENARIO) * 4, # cp end of table
+	0x20, 0x01,             # jr nz, .store
+	0xaf,                   # xor a
+	0xe0, 0x80,             # .store: ldh [$80], a
+	0xc1,                   # pop bc
+	0xe1,                   # pop hl
+	0xf1,                   # pop af
+	0xd9,                   # reti
+]
+put(HANDLER, handler)
+
+table = []
+for i, (ly, read, write, value) in enumerate(SCENARIO):
+	table += [read, write, value, SCENARIO[(i + 1) % len(SCENARIO)][0]]
+put(TABLE, table)
+
+# a different pattern in every row, so any line drawn into the wrong
+# place shows
+put(TILE, [0x00, 0xff, 0xff, 0x00, 0x0f, 0x3c, 0xf0, 0xc3,
+		   0x33, 0x0f, 0xcc, 0xf0, 0x55, 0x99, 0xaa, 0x66])
+
+checksum = 0
+for b in rom[0x0134:0x014d]:
+	checksum = (checksum - b - 1) & 0xff
+rom[0x014d] = checksum
+
+with open(sys.argv[1] if len(sys.argv) > 1 else "midframe.gb", "wb") as f:
+	f.write(rom)
@@ -9,74 +9,122 @@
 #include "timer.h"
 #include "io.h"
 
-timer::timer(io &io)
-	: _io    (io)
-	, counter(0)
-{
-}
+// The timer is a 16 bit counter that runs at the CPU clock; DIV is its
+// upper half, and TIMA counts falling edges of one of its bits. Neither
+// is stepped: both are derived from the global cycle counter when needed.
 
-void timer::
-reset()
+timer::timer(io &io)
+	: _io     (io)
+	, div_base(0)
+	, synced  (0)
 {
-	counter = 0;
 }
 
-void timer::
-step()
+// the bit of the counter that clocks TIMA
+int timer::
+tac_bit()
 {
-	if (!(_io.reg[rTAC] & 4)) {
-		return;
-	}
-
-	int divider;
 	switch (_io.reg[rTAC] & 3) {
 		default: // clang is stupid
 		case 0:
-			divider = 1024;
-			break;
+			return 9; // 4096 Hz
 		case 1:
-			divider = 16;
-			break;
+			return 3; // 262144 Hz
 		case 2:
-			divider = 64;
-			break;
+			return 5; // 65536 Hz
 		case 3:
-			divider = 256;
-			break;
+			return 7; // 16384 Hz
 	}
+}
 
-	//	printf("TIMER STEP %d %d %d\n", divider, counter, _io.reg[rTIMA]);
+bool timer::
+tac_signal()
+{
+	return (_io.reg[rTAC] & 4) && ((_io.cycle - div_base) >> tac_bit() & 1);
+}
 
-	if (++counter == divider) {
-		counter = 0;
-		if (++_io.reg[rTIMA] == 0) {
-			_io.reg[rTIMA] = _io.reg[rTMA];
-			//			printf("TIMER FIRED %s:%d\n", __FILE__, __LINE__);
-			_io.irq_set_pending(2);
+void timer::
+tick(uint64_t ticks)
+{
+	while (ticks) {
+		uint64_t until_overflow = 256 - _io.reg[rTIMA];
+		if (ticks < until_overflow) {
+			_io.reg[rTIMA] += ticks;
+			break;
 		}
+		ticks -= until_overflow;
+		_io.reg[rTIMA] = _io.reg[rTMA];
+		_io.irq_set_pending(2);
 	}
 }
 
+// Catches up with the CPU: counts the falling edges since the last sync.
+void timer::
+sync()
+{
+	uint64_t from = synced - div_base;
+	uint64_t to = _io.cycle - div_base;
+	synced = _io.cycle;
+
+	if (_io.reg[rTAC] & 4) {
+		int shift = tac_bit() + 1;
+		tick((to >> shift) - (from >> shift));
+	}
+
+	schedule();
+}
+
+void timer::
+schedule()
+{
+	if (!(_io.reg[rTAC] & 4)) {
+		_io.schedule(event_timer, EVENT_NEVER);
+		return;
+	}
+
+	int shift = tac_bit() + 1;
+	uint64_t edges = ((synced - div_base) >> shift) + 256 - _io.reg[rTIMA];
+	_io.schedule(event_timer, div_base + (edges << shift));
+}
+
 uint8_t timer::
 read(uint8_t a8)
 {
-	// these behave like RAM
-	return _io.reg[a8];
+	switch (a8) {
+		case rDIV:
+			return (_io.cycle - div_base) >> 8;
+		default:
+			return _io.reg[a8];
+	}
 }
 
+// expects the timer to be synced
 void timer::
 write(uint8_t a8, uint8_t d8)
 {
 	switch (a8) {
-		case rTAC:
-		case rTIMA:
+		case rDIV: {
+			// resetting the counter can cause a falling edge
+			bool signal = tac_signal();
+			div_base = _io.cycle;
+			if (signal) {
+				tick(1);
+			}
+			break;
+		}
+		case rTAC: {
+			// so can switching the bit or disabling the timer
+			bool signal = tac_signal();
 			_io.reg[a8] = d8;
-			reset();
+			if (signal && !tac_signal()) {
+				tick(1);
+			}
 			break;
+		}
 		default:
-			printf("warning: timer I/O write %s 0xff%02x <- 0x%02x\n", name_for_io_reg(a8), a8, d8);
 			_io.reg[a8] = d8;
 			break;
 	}
-}
 
+	schedule();
+}
@@ -17,10 +17,14 @@ class io;
 class timer {
 private:
 	io  &_io;
-	int  counter;
+	uint64_t div_base; // cycle at which the counter was last reset
+	uint64_t synced;   // cycle the timer has been run up to
 
 private:
-	void reset();
+	int tac_bit();
+	bool tac_signal();
+	void tick(uint64_t ticks);
+	void schedule();
 
 protected:
     friend class gb;
@@ -31,7 +35,7 @@ public:
 	void write(uint8_t a8, uint8_t d8);
 
 public:
-	void step();
+	void sync();
 };
 
 #endif /* timer_h */
@@ -0,0 +1,64 @@
+//
+//  writelog.cc
+//  gbppu
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "writelog.h"
+
+writelog::writelog(int log2_size)
+{
+	mask = (1ULL << log2_size) - 1;
+	entries = (writelog_entry_t *)calloc(mask + 1, sizeof(writelog_entry_t));
+	last = (writelog_entry_t *)calloc(0x10000, sizeof(writelog_entry_t));
+	last_seq = (uint64_t *)calloc(0x10000, sizeof(uint64_t));
+	count = 0;
+}
+
+writelog::~writelog()
+{
+	free(entries);
+	free(last);
+	free(last_seq);
+}
+
+void writelog::
+clear()
+{
+	memset(last, 0, 0x10000 * sizeof(writelog_entry_t));
+	memset(last_seq, 0, 0x10000 * sizeof(uint64_t));
+	count = 0;
+}
+
+const writelog_entry_t *writelog::
+get_entry(uint64_t seq)
+{
+	if (seq >= count || count - seq > mask + 1) {
+		return 0;
+	}
+	return &entries[seq & mask];
+}
+
+const writelog_entry_t *writelog::
+last_write(uint16_t address, uint64_t before_cycle)
+{
+	if (!last_seq[address]) {
+		return 0;
+	}
+	if (last[address].cycle < before_cycle) {
+		return &last[address];
+	}
+	uint64_t seq = last[address].prev;
+	while (seq) {
+		const writelog_entry_t *e = get_entry(seq - 1);
+		if (!e) {
+			return 0;
+		}
+		if (e->cycle < before_cycle) {
+			return e;
+		}
+		seq = e->prev;
+	}
+	return 0;
+}
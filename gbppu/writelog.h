@@ -0,0 +1,65 @@
+//
+//  writelog.h
+//  gbppu
+//
+
+#ifndef writelog_h
+#define writelog_h
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t cycle;
+	uint64_t prev;    // sequence number + 1 of the previous write to the same address
+	uint16_t pc;      // start of the writing instruction; the vector for
+	                  // the pushes of an interrupt dispatch
+	uint16_t address;
+	uint8_t  bank;    // of the writing instruction: the ROM bank if it is in
+	                  // 0x4000-0x7FFF, the RAM bank in 0xA000-0xBFFF, else 0
+	uint8_t  value;
+} writelog_entry_t;
+
+// A ring buffer of the most recent bus writes, plus a copy of the most
+// recent write to every address, so "who last wrote this?" is a single
+// lookup, however long ago it was.
+class writelog {
+private:
+	writelog_entry_t *entries;
+	uint64_t mask;
+	uint64_t count;
+	writelog_entry_t *last; // per address
+	uint64_t *last_seq;     // per address: sequence number + 1, 0 if never written
+
+public:
+	writelog(int log2_size);
+	~writelog();
+
+	void clear();
+
+	inline void add(uint64_t cycle, uint8_t bank, uint16_t pc, uint16_t address, uint8_t value)
+	{
+		writelog_entry_t *e = &entries[count & mask];
+		e->cycle = cycle;
+		e->prev = last_seq[address];
+		e->pc = pc;
+		e->address = address;
+		e->bank = bank;
+		e->value = value;
+		last[address] = *e;
+		last_seq[address] = ++count;
+	}
+
+	// most recent write to address before a cycle; 0 if there is none.
+	// The last write to every address is always kept, the ones before it
+	// only as long as they are in the ring buffer.
+	const writelog_entry_t *last_write(uint16_t address, uint64_t before_cycle = UINT64_MAX);
+
+	uint64_t get_count() const
+	{ return count; }
+	uint64_t get_size() const
+	{ return mask + 1; }
+	// entry by sequence number; 0 if it has dropped out of the ring buffer
+	const writelog_entry_t *get_entry(uint64_t seq);
+};
+
+#endif /* writelog_h */
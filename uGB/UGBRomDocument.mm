@@ -11,8 +11,8 @@
 #import <QuartzCore/QuartzCore.h>
 #import "UGBAudioOutput.h"
 
-// consumes pictureCopy
-static CGImageRef CreateGameBoyScreenCGImageRefFromPicture(uint8_t *pictureCopy, size_t pictureSize);
+// the picture has to stay unchanged while the image is in use
+static CGImageRef CreateGameBoyScreenCGImageRefFromPicture(const uint8_t *picture);
 
 @interface UGBRomDocument () {
     gb *gameboy;
@@ -71,6 +71,12 @@ static void consumeSoundInteger(int16_t value) {
 
         gb *localboy = new class gb(bootrom_filename, rom_filename);
         gameboy = localboy;
+        localboy->start_log_thread(stdout);
+        // the core writes the gray levels directly
+        static const uint32_t grays[3][4] = {
+            { 255, 170, 85, 0 }, { 255, 170, 85, 0 }, { 255, 170, 85, 0 },
+        };
+        localboy->set_ppu_format(pixel_indexed8, 0, grays);
 
         if (self.audioOutput) {
             s_circularBuffer = self.audioOutput.inputBuffer;
@@ -91,13 +97,20 @@ static void consumeSoundInteger(int16_t value) {
                 localboy->clear_ppu_dirty();
                 self.frameCount += 1;
                 
-                size_t pictureSize;
-                uint8_t *pictureCopy = localboy->copy_ppu_picture(pictureSize);
-                CGImageRef imageRef = CreateGameBoyScreenCGImageRefFromPicture(pictureCopy, pictureSize);
-                self.mostRecentCGImageRef = CFBridgingRelease(imageRef);
-                [CATransaction begin];
-                self.mainDisplayViewController.view.layer.contents = self.mostRecentCGImageRef;
-                [CATransaction commit];
+                // in turbo mode, only draw what can be shown
+                localboy->set_ppu_frame_skip(self.turbo ? 7 : 0);
+
+                // the frame stays ours until the next get_ppu_picture();
+                // the image copies it
+                bool fresh;
+                const uint8_t *picture = localboy->get_ppu_picture(&fresh);
+                if (fresh) {
+                    CGImageRef imageRef = CreateGameBoyScreenCGImageRefFromPicture(picture);
+                    self.mostRecentCGImageRef = CFBridgingRelease(imageRef);
+                    [CATransaction begin];
+                    self.mainDisplayViewController.view.layer.contents = self.mostRecentCGImageRef;
+                    [CATransaction commit];
+                }
                 
                 if (!self.turbo) {
                     // wait until the next 60 hz tick
@@ -189,7 +202,7 @@ static void consumeSoundInteger(int16_t value) {
 #define TILES_PER_ROW 16
 #define TILE_DIMENSION 8
 
-static uint8_t valueAtLocation(off_t location, uint8_t *tilemap) {
+static uint8_t valueAtLocation(off_t location, uint8_t *tiles) {
     // the location is an offset in an image in which we draw 8 tiles across
     // each tile is 8x8 bytes.
     int rowIndex = (int)location / (TILES_PER_ROW * TILE_DIMENSION); // divide through byte width of row
@@ -200,10 +213,8 @@ static uint8_t valueAtLocation(off_t location, uint8_t *tilemap) {
     
     int tileIndex = yPosition * TILES_PER_ROW + xPosition;
     
-    uint8_t *tilePointer = tilemap + (tileIndex * 16) + (yPositionInTile * 2);
-    uint8_t bitmask = 0x80 >> xPositionInTile;
-    uint8_t value =   ((*tilePointer & bitmask) ? 1 : 0)
-    + ((*(tilePointer+1) & bitmask) ? 2 : 0);
+    // the tiles are already decoded to one byte per pixel
+    uint8_t value = tiles[(tileIndex * TILE_DIMENSION + yPositionInTile) * TILE_DIMENSION + xPositionInTile];
     //NSLog(@"tileIndex:%x, xposition:%d, yposition:%d, positionInTile:(%d, %d) value:%d", tileIndex, xPosition, yPosition, xPositionInTile, yPositionInTile, value);
     
     return value;
@@ -236,7 +247,7 @@ static void _releaseInfo(void *info) {
     callbacks.releaseInfo = _releaseInfo;
     
     size_t tilemapSourceByteSize;
-    uint8_t *tilemapCopy = gameboy->copy_tilemap(tilemapSourceByteSize);
+    uint8_t *tilemapCopy = gameboy->copy_tiles(tilemapSourceByteSize);
     
     CGDataProviderRef provider = CGDataProviderCreateDirect(tilemapCopy, TILECOUNT * TILE_DIMENSION * TILE_DIMENSION, &callbacks);
     CGColorSpaceRef grayspace = CGColorSpaceCreateDeviceGray();
@@ -252,27 +263,12 @@ static void _releaseInfo(void *info) {
 
 
 
-static size_t _getBytesCallback(void *info, void *buffer, off_t position, size_t count) {
-    static const uint8_t colors[4] = { 255, 170, 85, 0 };
-    uint8_t *target = (uint8_t *)buffer;
-    uint8_t *source = ((uint8_t *)info) + position;
-    uint8_t *sourceEnd = source + count;
-    while (source < sourceEnd) {
-        *(target++) = colors[*(source)];
-        source++;
-    }
-    return count;
-}
-
-static CGImageRef CreateGameBoyScreenCGImageRefFromPicture(uint8_t *pictureCopy, size_t pictureSize) {
-    CGDataProviderDirectCallbacks callbacks;
-    callbacks.version = 0,
-    callbacks.getBytePointer = NULL;
-    callbacks.releaseBytePointer = NULL;
-    callbacks.getBytesAtPosition = _getBytesCallback;
-    callbacks.releaseInfo = _releaseInfo;
-    
-    CGDataProviderRef provider = CGDataProviderCreateDirect(pictureCopy, pictureSize, &callbacks);
+static CGImageRef CreateGameBoyScreenCGImageRefFromPicture(const uint8_t *picture) {
+    // the core reuses the frame two frames later, and the image may live
+    // much longer than that (and than the core), so it gets its own copy
+    CFDataRef data = CFDataCreate(NULL, picture, FRAMEBUFFER_SIZE);
+    CGDataProviderRef provider = CGDataProviderCreateWithCFData(data);
+    CFRelease(data);
     CGColorSpaceRef grayspace = CGColorSpaceCreateDeviceGray();
     
     CGImageRef image = CGImageCreate(160, 144, 8, 8, 160, grayspace, kCGBitmapByteOrderDefault | kCGImageAlphaNone, provider, NULL, NO, kCGRenderingIntentDefault);